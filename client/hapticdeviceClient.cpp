@@ -7,15 +7,25 @@
  *
  */
 
+#include <cmath>
 #include <string>
 #include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <future>
 
 #include <yarp/os/Log.h>
 #include <yarp/os/Network.h>
+#include <yarp/os/ContactStyle.h>
+#include <yarp/os/QosStyle.h>
+#include <yarp/os/Time.h>
 
 #include "hapticdeviceClient.h"
 #include "common.h"
 
+#define HAPTICDEVICE_CLIENT_STALE_TIMEOUT   0.25    // [s]
+#define HAPTICDEVICE_CLIENT_STALE_PERIODS   4.0
+
 using namespace std;
 using namespace yarp::os;
 using namespace yarp::dev;
@@ -23,269 +33,2266 @@ using namespace yarp::sig;
 
 
 /*********************************************************************/
-void StatePort::onRead(Bottle &state)
+void StatePort::onRead(Vector &state)
+{
+    if ((client!=NULL) && (state.length()>=8))
+    {
+        // wrappers not advertising the configuration epoch
+        // leave the cache of the properties disabled
+        client->configEpoch=(state.length()>8)?(int)state[8]:-1;
+
+        double now=Time::now();
+        client->lastArrival=now;
+        if (client->stale)
+        {
+            double outage=now-client->staleSince;
+            client->lastRecovery=outage;
+            if (outage>client->worstRecovery)
+                client->worstRecovery=outage;
+            client->stale=false;
+
+            if (client->verbosity>0)
+                yInfo("*** Haptic Device Client: state stream recovered after %g [s]",outage);
+        }
+
+        Stamp stamp;
+        getEnvelope(stamp);
+
+        hapticdevice::HapticState sample;
+        std::copy(state.begin(),state.begin()+3,sample.position);
+        std::copy(state.begin()+3,state.begin()+6,sample.orientation);
+        std::copy(state.begin()+6,state.begin()+8,sample.buttons);
+        sample.stamp=stamp.getTime();
+        sample.sequence=stamp.getCount();
+        client->state.store(sample);
+
+        {
+            std::lock_guard lg(client->historyMutex);
+            client->history.push(sample);
+        }
+
+        if (client->predictionHorizon>0.0)
+        {
+            std::lock_guard lg(client->mutex);
+            client->arrival=now;
+            client->predictor.update(state.data(),sample.stamp);
+        }
+
+        {
+            std::lock_guard lg(client->waitMutex);
+            client->generation++;
+        }
+        client->waitCondition.notify_all();
+
+        // the callbacks may register and unregister callbacks,
+        // hence they are not invoked while holding the lock
+        bool any;
+        {
+            std::lock_guard lg(client->callbackMutex);
+            any=!client->callbacks.empty();
+            if (any)
+            {
+                client->dispatching.assign(client->callbacks.begin(),
+                                           client->callbacks.end());
+                client->dispatcher=std::this_thread::get_id();
+            }
+        }
+
+        if (any)
+        {
+            // entries get cleared by callbacks unregistering others
+            for (size_t i=0; i<client->dispatching.size(); i++)
+                if (hapticdevice::HapticStateCallback *callback=client->dispatching[i])
+                    callback->onState(sample);
+
+            {
+                std::lock_guard lg(client->callbackMutex);
+                client->dispatcher=std::thread::id();
+                client->dispatchRounds++;
+            }
+            client->callbackCondition.notify_all();
+        }
+    }
+}
+
+
+/*********************************************************************/
+void AsyncReplyPort::onRead(Bottle &reply)
+{
+    // the stream carries the replies to all the clients
+    Bottle *header=reply.get(0).asList();
+    if ((client==NULL) || (header==NULL) ||
+        (header->get(0).asString()!=getName()))
+        return;
+
+    Bottle rep=reply.tail();
+    client->complete(header->get(1).asInt32(),&rep);
+}
+
+
+/*********************************************************************/
+void EventPort::onRead(Bottle &events)
+{
+    if (client!=NULL)
+        client->receive(events);
+}
+
+
+/*********************************************************************/
+void StateSeqLock::store(const hapticdevice::HapticState &state)
+{
+    // odd counts flag that an update is in progress
+    unsigned int s=seq.load(std::memory_order_relaxed);
+    seq.store(s+1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int i=0; i<3; i++)
+    {
+        data[i].store(state.position[i],std::memory_order_relaxed);
+        data[3+i].store(state.orientation[i],std::memory_order_relaxed);
+    }
+    data[6].store(state.buttons[0],std::memory_order_relaxed);
+    data[7].store(state.buttons[1],std::memory_order_relaxed);
+    data[8].store(state.stamp,std::memory_order_relaxed);
+    data[9].store(state.sequence,std::memory_order_relaxed);
+
+    seq.store(s+2,std::memory_order_release);
+}
+
+
+/*********************************************************************/
+bool StateSeqLock::load(hapticdevice::HapticState &state) const
+{
+    while (true)
+    {
+        unsigned int s0=seq.load(std::memory_order_acquire);
+        if (s0&1)
+            continue;
+
+        for (int i=0; i<3; i++)
+        {
+            state.position[i]=data[i].load(std::memory_order_relaxed);
+            state.orientation[i]=data[3+i].load(std::memory_order_relaxed);
+        }
+        state.buttons[0]=data[6].load(std::memory_order_relaxed);
+        state.buttons[1]=data[7].load(std::memory_order_relaxed);
+        state.stamp=data[8].load(std::memory_order_relaxed);
+        state.sequence=(int)data[9].load(std::memory_order_relaxed);
+
+        // retry if the writer stepped in meanwhile
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed)==s0)
+            return (s0!=0);
+    }
+}
+
+
+/*********************************************************************/
+static void rpy2quat(const double *rpy, double *q)
+{
+    // R=Rz(yaw)*Ry(pitch)*Rx(roll), as in yarp::math::rpy2dcm()
+    double cr=cos(0.5*rpy[0]),sr=sin(0.5*rpy[0]);
+    double cp=cos(0.5*rpy[1]),sp=sin(0.5*rpy[1]);
+    double cy=cos(0.5*rpy[2]),sy=sin(0.5*rpy[2]);
+    q[0]=cr*cp*cy+sr*sp*sy;
+    q[1]=sr*cp*cy-cr*sp*sy;
+    q[2]=cr*sp*cy+sr*cp*sy;
+    q[3]=cr*cp*sy-sr*sp*cy;
+}
+
+
+/*********************************************************************/
+static void quat2rpy(const double *q, const double *ref, double *rpy)
+{
+    double sp=std::max(-1.0,std::min(2.0*(q[0]*q[2]-q[3]*q[1]),1.0));
+    double sol[2][3];
+    sol[0][0]=atan2(2.0*(q[0]*q[1]+q[2]*q[3]),1.0-2.0*(q[1]*q[1]+q[2]*q[2]));
+    sol[0][1]=asin(sp);
+    sol[0][2]=atan2(2.0*(q[0]*q[3]+q[1]*q[2]),1.0-2.0*(q[2]*q[2]+q[3]*q[3]));
+    sol[1][0]=sol[0][0]+M_PI;
+    sol[1][1]=M_PI-sol[0][1];
+    sol[1][2]=sol[0][2]+M_PI;
+
+    // among the equivalent triplets, the closest to the reference
+    // avoids jumps with respect to the interpolated samples
+    double best=-1.0;
+    for (auto &angles:sol)
+    {
+        double d=0.0;
+        for (int i=0; i<3; i++)
+        {
+            angles[i]-=2.0*M_PI*std::round((angles[i]-ref[i])/(2.0*M_PI));
+            d+=(angles[i]-ref[i])*(angles[i]-ref[i]);
+        }
+
+        if ((best<0.0) || (d<best))
+        {
+            best=d;
+            std::copy(angles,angles+3,rpy);
+        }
+    }
+}
+
+
+/*********************************************************************/
+static void slerp(const double *q0, const double *q1, const double s,
+                  double *q)
+{
+    double dot=q0[0]*q1[0]+q0[1]*q1[1]+q0[2]*q1[2]+q0[3]*q1[3];
+    double sign=(dot<0.0)?-1.0:1.0;
+    dot*=sign;
+
+    double w0=1.0-s,w1=s;
+    if (dot<0.9995)
+    {
+        double theta=acos(dot);
+        double st=sin(theta);
+        w0=sin((1.0-s)*theta)/st;
+        w1=sin(s*theta)/st;
+    }
+
+    double norm=0.0;
+    for (int i=0; i<4; i++)
+    {
+        q[i]=w0*q0[i]+sign*w1*q1[i];
+        norm+=q[i]*q[i];
+    }
+
+    norm=sqrt(norm);
+    for (int i=0; i<4; i++)
+        q[i]/=norm;
+}
+
+
+/*********************************************************************/
+StateHistory::StateHistory() : mask(0), head(0), count(0)
+{
+}
+
+
+/*********************************************************************/
+void StateHistory::resize(const size_t capacity)
+{
+    // power-of-two sizes turn the wrap-around into a mask
+    size_t size=1;
+    while (size<capacity)
+        size<<=1;
+
+    stamps.assign((capacity>0)?size:0,0.0);
+    samples.assign(stamps.size(),hapticdevice::HapticState());
+    mask=(capacity>0)?size-1:0;
+    clear();
+}
+
+
+/*********************************************************************/
+void StateHistory::clear()
+{
+    head=count=0;
+}
+
+
+/*********************************************************************/
+void StateHistory::push(const hapticdevice::HapticState &state)
+{
+    if (stamps.empty())
+        return;
+
+    if (count>0)
+    {
+        double last=stamps[index(count-1)];
+        if (state.stamp==last)
+            return;
+
+        // stamps going backwards reveal a new wrapper
+        if (state.stamp<last)
+            clear();
+    }
+
+    size_t i;
+    if (count<stamps.size())
+        i=index(count++);
+    else
+    {
+        i=head;
+        head=index(1);
+    }
+
+    stamps[i]=state.stamp;
+    samples[i]=state;
+}
+
+
+/*********************************************************************/
+bool StateHistory::lookup(const double t, hapticdevice::HapticState &state) const
+{
+    if ((count==0) || (t<stamps[head]) || (t>stamps[index(count-1)]))
+        return false;
+
+    // first sample not older than t
+    size_t lo=0,hi=count-1;
+    while (lo<hi)
+    {
+        size_t mid=(lo+hi)>>1;
+        if (stamps[index(mid)]<t)
+            lo=mid+1;
+        else
+            hi=mid;
+    }
+
+    const hapticdevice::HapticState &s1=samples[index(lo)];
+    if ((lo==0) || (s1.stamp==t))
+    {
+        state=s1;
+        return true;
+    }
+
+    const hapticdevice::HapticState &s0=samples[index(lo-1)];
+    double s=(t-s0.stamp)/(s1.stamp-s0.stamp);
+    const hapticdevice::HapticState &closest=(s<0.5)?s0:s1;
+
+    double q0[4],q1[4],q[4],ref[3];
+    rpy2quat(s0.orientation,q0);
+    rpy2quat(s1.orientation,q1);
+    slerp(q0,q1,s,q);
+    for (int i=0; i<3; i++)
+    {
+        state.position[i]=s0.position[i]+s*(s1.position[i]-s0.position[i]);
+        ref[i]=s0.orientation[i]+s*(s1.orientation[i]-s0.orientation[i]);
+    }
+    quat2rpy(q,ref,state.orientation);
+
+    std::copy(closest.buttons,closest.buttons+2,state.buttons);
+    state.sequence=closest.sequence;
+    state.stamp=t;
+    return true;
+}
+
+
+/*********************************************************************/
+StatePredictor::StatePredictor() : alpha(0.8), beta(0.6)
+{
+    reset();
+}
+
+
+/*********************************************************************/
+void StatePredictor::configure(const double alpha, const double beta)
+{
+    this->alpha=alpha;
+    this->beta=beta;
+    reset();
+}
+
+
+/*********************************************************************/
+void StatePredictor::reset()
+{
+    std::fill(x,x+6,0.0);
+    std::fill(v,v+6,0.0);
+    t=0.0;
+    valid=false;
+}
+
+
+/*********************************************************************/
+void StatePredictor::update(const double *z, const double t)
+{
+    double dt=t-this->t;
+
+    // restart from scratch upon gaps in the stream
+    if (!valid || (dt<=0.0) || (dt>0.5))
+    {
+        std::copy(z,z+6,x);
+        std::fill(v,v+6,0.0);
+        this->t=t;
+        valid=true;
+        return;
+    }
+
+    for (int i=0; i<6; i++)
+    {
+        double r=z[i]-(x[i]+v[i]*dt);
+
+        // angles are compared on the shortest arc and kept
+        // within +/-pi as the device reports them
+        if (i>=3)
+            r=std::remainder(r,2.0*M_PI);
+
+        x[i]+=v[i]*dt+alpha*r;
+        v[i]+=(beta/dt)*r;
+        if (i>=3)
+            x[i]=std::remainder(x[i],2.0*M_PI);
+    }
+
+    this->t=t;
+}
+
+
+/*********************************************************************/
+void StatePredictor::predict(double *xp, const double dt) const
+{
+    for (int i=0; i<6; i++)
+        xp[i]=x[i]+v[i]*dt;
+    for (int i=3; i<6; i++)
+        xp[i]=std::remainder(xp[i],2.0*M_PI);
+}
+
+
+/*********************************************************************/
+ClockSync::ClockSync() : PeriodicThread(1.0), client(NULL)
+{
+    reset();
+}
+
+
+/*********************************************************************/
+void ClockSync::reset()
+{
+    std::lock_guard lg(mutex);
+    n=head=0;
+    estOffset=estDrift=tRef=0.0;
+}
+
+
+/*********************************************************************/
+void ClockSync::run()
+{
+    if (client==NULL)
+        return;
+
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::get_time);
+
+    double t1=Time::now();
+    bool ok=client->rpc(cmd,rep);
+    double t4=Time::now();
+
+    if (ok && (rep.get(0).asVocab32()==hapticdevice::ack) && (rep.size()>=3))
+        addSample(t1,rep.get(1).asFloat64(),rep.get(2).asFloat64(),t4);
+}
+
+
+/*********************************************************************/
+void ClockSync::addSample(const double t1, const double t2,
+                          const double t3, const double t4)
+{
+    std::lock_guard lg(mutex);
+    t[head]=0.5*(t1+t4);
+    offset[head]=0.5*((t2-t1)+(t3-t4));
+    rtt[head]=(t4-t1)-(t3-t2);
+    head=(head+1)%window;
+    n=std::min(n+1,window);
+
+    // the exchanges with the shortest round-trip are the least
+    // affected by asymmetric delays, hence we fit only those
+    double minRtt=*std::min_element(rtt,rtt+n);
+    double tol=2.0*minRtt+1e-3;
+
+    int m=0;
+    double tMean=0.0,oMean=0.0;
+    for (int i=0; i<n; i++)
+    {
+        if (rtt[i]<=tol)
+        {
+            tMean+=t[i];
+            oMean+=offset[i];
+            m++;
+        }
+    }
+    tMean/=m;
+    oMean/=m;
+
+    double num=0.0,den=0.0;
+    for (int i=0; i<n; i++)
+    {
+        if (rtt[i]<=tol)
+        {
+            num+=(t[i]-tMean)*(offset[i]-oMean);
+            den+=(t[i]-tMean)*(t[i]-tMean);
+        }
+    }
+
+    estOffset=oMean;
+    estDrift=(den>1e-6)?num/den:0.0;
+    tRef=tMean;
+}
+
+
+/*********************************************************************/
+bool ClockSync::getOffset(const double t, double &offset, double &drift)
+{
+    std::lock_guard lg(mutex);
+    if (n==0)
+        return false;
+
+    offset=estOffset+estDrift*(t-tRef);
+    drift=estDrift;
+    return true;
+}
+
+
+/*********************************************************************/
+bool ClockSync::toLocal(const double remote, double &local)
+{
+    std::lock_guard lg(mutex);
+    if (n==0)
+        return false;
+
+    // solve remote=local+offset(local) for the local time
+    local=(remote-estOffset+estDrift*tRef)/(1.0+estDrift);
+    return true;
+}
+
+
+/*********************************************************************/
+RequestTimer::RequestTimer() : PeriodicThread(0.1), client(NULL)
+{
+}
+
+
+/*********************************************************************/
+void RequestTimer::run()
+{
+    if (client!=NULL)
+        client->expirePending(Time::now());
+}
+
+
+/*********************************************************************/
+RequestSender::RequestSender() : port(NULL), stopping(false)
+{
+}
+
+
+/*********************************************************************/
+RequestSender::~RequestSender()
+{
+    stop();
+}
+
+
+/*********************************************************************/
+void RequestSender::start(BufferedPort<Bottle> *port, const string &replyTo)
+{
+    stop();
+    this->port=port;
+    this->replyTo=replyTo;
+    {
+        std::lock_guard lg(mutex);
+        queue.clear();
+        stopping=false;
+    }
+    thread=std::thread(&RequestSender::loop,this);
+}
+
+
+/*********************************************************************/
+void RequestSender::stop()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard lg(mutex);
+            stopping=true;
+        }
+        condition.notify_one();
+        thread.join();
+    }
+}
+
+
+/*********************************************************************/
+bool RequestSender::push(const int id, const Bottle &cmd)
+{
+    {
+        std::lock_guard lg(mutex);
+        if (stopping || !thread.joinable() || (queue.size()>=capacity))
+            return false;
+
+        queue.push_back({id,cmd});
+    }
+    condition.notify_one();
+    return true;
+}
+
+
+/*********************************************************************/
+void RequestSender::loop()
+{
+    while (true)
+    {
+        Entry entry;
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            condition.wait(lck,[this]() { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+
+            entry=std::move(queue.front());
+            queue.pop_front();
+        }
+
+        // ((<reply-to> <id>) <command> ...); the requests are never
+        // dropped here, hence the previous ones are waited for
+        Bottle &request=port->prepare();
+        request.clear();
+        Bottle &header=request.addList();
+        header.addString(replyTo);
+        header.addInt32(entry.id);
+        request.append(entry.cmd);
+        port->writeStrict();
+    }
+}
+
+
+/*********************************************************************/
+ConnectionMonitor::ConnectionMonitor() : PeriodicThread(0.05), client(NULL)
+{
+    configure(0.1,2.0);
+}
+
+
+/*********************************************************************/
+void ConnectionMonitor::configure(const double minBackoff,
+                                  const double maxBackoff)
+{
+    this->minBackoff=minBackoff;
+    this->maxBackoff=std::max(minBackoff,maxBackoff);
+    backoff=minBackoff;
+    nextAttempt=0.0;
+}
+
+
+/*********************************************************************/
+void ConnectionMonitor::run()
+{
+    if (client==NULL)
+        return;
+
+    double now=Time::now();
+    if (!client->stale)
+    {
+        double last=client->lastArrival;
+        if (now-last<client->staleTimeout)
+        {
+            backoff=minBackoff;
+            return;
+        }
+
+        client->staleSince=last;
+        client->stale=true;
+        nextAttempt=now;
+
+        if (client->verbosity>0)
+            yInfo("*** Haptic Device Client: no state received for %g [s], reconnecting",
+                  now-last);
+    }
+
+    if (now<nextAttempt)
+        return;
+
+    // a successful connection is given the time to deliver
+    // samples before being deemed broken again
+    bool ok=client->reconnect();
+    nextAttempt=Time::now()+(ok?std::max(backoff,client->staleTimeout.load()):backoff);
+    backoff=std::min(2.0*backoff,maxBackoff);
+}
+
+
+/*********************************************************************/
+FeedbackSender::FeedbackSender() : PeriodicThread(0.001), client(NULL),
+                                   fresh(false), sent(0), coalesced(0)
+{
+    std::fill(fdbck,fdbck+3,0.0);
+}
+
+
+/*********************************************************************/
+void FeedbackSender::post(const Vector &fdbck)
+{
+    std::lock_guard lg(mutex);
+    if (fresh)
+        coalesced++;
+
+    std::copy(fdbck.begin(),fdbck.end(),this->fdbck);
+    fresh=true;
+}
+
+
+/*********************************************************************/
+void FeedbackSender::discard()
+{
+    std::lock_guard lg(mutex);
+    fresh=false;
+}
+
+
+/*********************************************************************/
+void FeedbackSender::getStats(unsigned long &sent, unsigned long &coalesced)
+{
+    std::lock_guard lg(mutex);
+    sent=this->sent;
+    coalesced=this->coalesced;
+}
+
+
+/*********************************************************************/
+void FeedbackSender::run()
+{
+    if (client==NULL)
+        return;
+
+    std::lock_guard lg(mutex);
+
+    // the force stays pending while the link is still busy
+    // with the previous one, to be overwritten by newer ones
+    if (!fresh || client->feedbackPort.isWriting())
+        return;
+
+    Vector &out=client->feedbackPort.prepare();
+    out.resize(3);
+    std::copy(fdbck,fdbck+3,out.begin());
+    client->feedbackPort.write();
+
+    fresh=false;
+    sent++;
+}
+
+
+/*********************************************************************/
+HapticDeviceClient::HapticDeviceClient() : activeRemote(0), staleTimeoutOption(-1.0),
+                                           staleTimeout(0.0),
+                                           lastArrival(0.0), staleSince(0.0),
+                                           stale(false), lastRecovery(-1.0),
+                                           worstRecovery(-1.0), connectTime(0.0),
+                                           asyncTimeout(1.0), nextRequestId(0),
+                                           asyncEnabled(false),
+                                           eventQueueSize(256), lastEventSequence(-1),
+                                           lostEvents(0), eventsClosing(false),
+                                           generation(0), closing(false),
+                                           dispatchRounds(0), cacheEnabled(true),
+                                           configEpoch(-1),
+                                           predictionHorizon(0.0),
+                                           arrival(0.0)
+{
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::open(Searchable &config)
+{
+    if (!config.check("remote"))
+    {
+        yError("*** Haptic Device Client: \"remote\" option missing, failed to open!");
+        return false;
+    }
+
+    if (!config.check("local"))
+    {
+        yError("*** Haptic Device Client: \"local\" option missing, failed to open!");
+        return false;
+    }
+
+    // a list of stem-names provides standby wrappers to fail over to
+    remotes.clear();
+    if (Bottle *list=config.find("remote").asList())
+    {
+        for (size_t i=0; i<list->size(); i++)
+            remotes.push_back(list->get(i).asString());
+    }
+    else
+        remotes.push_back(config.find("remote").asString());
+
+    if (remotes.empty())
+    {
+        yError("*** Haptic Device Client: \"remote\" option empty, failed to open!");
+        return false;
+    }
+
+    string local=config.find("local").asString().c_str();
+    verbosity=config.check("verbosity",Value(0)).asInt32();
+    double clockSyncPeriod=config.check("clock-sync-period",Value(1.0)).asFloat64();
+    staleTimeoutOption=config.check("stale-timeout")?config.find("stale-timeout").asFloat64():-1.0;
+    staleTimeout=(staleTimeoutOption<0.0)?HAPTICDEVICE_CLIENT_STALE_TIMEOUT:staleTimeoutOption;
+    asyncTimeout=config.check("async-timeout",Value(1.0)).asFloat64();
+    stateTier=config.check("state-tier",Value("")).asString();
+    stateSource=stateTier.empty()?string("/state:o"):"/state/"+stateTier+":o";
+    monitor.configure(config.check("reconnect-backoff",Value(0.1)).asFloat64(),
+                      config.check("reconnect-max-backoff",Value(2.0)).asFloat64());
+    if (!configureStream(config,"state","udp",false,stateStream) ||
+        !configureStream(config,"feedback","tcp",false,feedbackStream) ||
+        !configureStream(config,"rpc","tcp",true,rpcStream))
+        return false;
+    string feedbackMode=config.check("feedback-mode",Value("strict")).asString();
+    if ((feedbackMode!="strict") && (feedbackMode!="latest"))
+    {
+        yError("*** Haptic Device Client: unknown feedback-mode \"%s\", failed to open!",
+               feedbackMode.c_str());
+        return false;
+    }
+    double feedbackRate=config.check("feedback-rate",Value(1000.0)).asFloat64();
+    if ((feedbackMode=="latest") && (feedbackRate<=0.0))
+    {
+        yError("*** Haptic Device Client: feedback-rate must be positive, failed to open!");
+        return false;
+    }
+    cacheEnabled=(config.check("property-cache",Value("on")).asString()=="on");
+    configEpoch=-1;
+    invalidateCache();
+    {
+        std::lock_guard lg(historyMutex);
+        history.resize(std::max(0,config.check("history-size",Value(1024)).asInt32()));
+    }
+    predictionHorizon=config.check("prediction-horizon",Value(0.0)).asFloat64();
+    predictor.configure(config.check("prediction-alpha",Value(0.8)).asFloat64(),
+                        config.check("prediction-beta",Value(0.6)).asFloat64());
+
+    {
+        std::lock_guard lg(waitMutex);
+        closing=false;
+    }
+    {
+        std::lock_guard lg(eventMutex);
+        eventQueueSize=std::max(1,config.check("event-queue-size",Value(256)).asInt32());
+        events.clear();
+        lastEventSequence=-1;
+        lostEvents=0;
+        eventsClosing=false;
+    }
+
+    // the registrations with the name server are independent
+    // of each other, hence they are carried out concurrently
+    double t0=Time::now();
+    future<bool> opened[]={
+        async(launch::async,[&](){ return statePort.open(local+"/state:i"); }),
+        async(launch::async,[&](){ return feedbackPort.open(local+"/feedback:o"); }),
+        async(launch::async,[&](){ return rpcPort.open(local+"/rpc"); }),
+        async(launch::async,[&](){ return asyncPort.open(local+"/async:o"); }),
+        async(launch::async,[&](){ return asyncReplyPort.open(local+"/async:i"); }),
+        async(launch::async,[&](){ return eventPort.open(local+"/events:i"); })
+    };
+    bool ok=true;
+    for (auto &o:opened)
+        ok&=o.get();
+    statePort.setClient(this);
+    asyncReplyPort.setClient(this);
+    eventPort.setClient(this);
+    double t1=Time::now();
+
+    if (ok)
+    {
+        ok=false;
+        for (activeRemote=0; activeRemote<remotes.size(); activeRemote++)
+        {
+            if ((ok=connectTo(remotes[activeRemote])))
+                break;
+        }
+    }
+    else
+        yError("*** Haptic Device Client: unable to open the local ports");
+    double t2=Time::now();
+
+    if (!ok)
+    {
+        statePort.close();
+        feedbackPort.close();
+        rpcPort.close();
+        asyncPort.close();
+        asyncReplyPort.close();
+        eventPort.close();
+
+        yError("*** Haptic Device Client: unable to connect to Haptic Device Wrapper, failed to open!");
+        return false;
+    }
+
+    lastArrival=Time::now();
+    stale=false;
+    lastRecovery=worstRecovery=-1.0;
+    if (staleTimeout>0.0)
+    {
+        monitor.setClient(this);
+        monitor.setPeriod(std::max(0.01,0.25*staleTimeout));
+        monitor.start();
+    }
+
+    requestSender.start(&asyncPort,asyncReplyPort.getName());
+    if (asyncTimeout>0.0)
+    {
+        requestTimer.setClient(this);
+        requestTimer.setPeriod(std::max(0.01,0.25*asyncTimeout));
+        requestTimer.start();
+    }
+
+    if (feedbackMode=="latest")
+    {
+        feedbackSender.discard();
+        feedbackSender.setClient(this);
+        feedbackSender.setPeriod(1.0/feedbackRate);
+        feedbackSender.start();
+    }
+
+    if (clockSyncPeriod>0.0)
+    {
+        clockSync.reset();
+        clockSync.setClient(this);
+        clockSync.setPeriod(clockSyncPeriod);
+        clockSync.start();
+    }
+
+    if (verbosity>0)
+    {
+        double t3=Time::now();
+        yInfo("*** Haptic Device Client: opened, connected to %s",
+              remotes[activeRemote].c_str());
+        yInfo("*** Haptic Device Client: startup took %.1f ms (ports %.1f ms, "
+              "connections %.1f ms, other attempts %.1f ms, threads %.1f ms)",
+              1e3*(t3-t0),1e3*(t1-t0),1e3*connectTime,
+              1e3*(t2-t1-connectTime),1e3*(t3-t2));
+    }
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::close()
+{
+    if (feedbackSender.isRunning())
+    {
+        feedbackSender.stop();
+        if (verbosity>0)
+        {
+            unsigned long sent,coalesced;
+            feedbackSender.getStats(sent,coalesced);
+            yInfo("*** Haptic Device Client: feedback sent=%lu coalesced=%lu",
+                  sent,coalesced);
+        }
+    }
+
+    if (monitor.isRunning())
+        monitor.stop();
+
+    if (clockSync.isRunning())
+        clockSync.stop();
+
+    if (requestTimer.isRunning())
+        requestTimer.stop();
+
+    // the sender may be waiting for a request to be written
+    asyncPort.interrupt();
+    requestSender.stop();
+
+    // release whoever is waiting for samples
+    {
+        std::lock_guard lg(waitMutex);
+        closing=true;
+    }
+    waitCondition.notify_all();
+    {
+        std::lock_guard lg(eventMutex);
+        eventsClosing=true;
+    }
+    eventCondition.notify_all();
+
+    statePort.close();
+    feedbackPort.close();
+    rpcPort.close();
+    asyncPort.close();
+    asyncReplyPort.close();
+    eventPort.close();
+    failPending();
+
+    if (verbosity>0)
+        yInfo("*** Haptic Device Client: closed");
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::configureStream(Searchable &config, const string &name,
+                                         const string &carrier, const bool reliable,
+                                         StreamSettings &settings)
+{
+    settings.name=name;
+    settings.carrier=config.check(name+"-carrier",Value(carrier)).asString();
+    settings.packetPriority=config.check(name+"-packet-priority",Value("")).asString();
+    settings.threadPriority=config.check(name+"-thread-priority",Value(-1)).asInt32();
+    settings.threadPolicy=config.check(name+"-thread-policy",Value(-1)).asInt32();
+
+    // request/reply exchanges cannot go over lossy carriers
+    const char *carriers[]={"tcp","fast_tcp","shmem","udp","mcast"};
+    size_t last=reliable?3:5;
+    if (std::find(carriers,carriers+last,settings.carrier)==carriers+last)
+    {
+        yError("*** Haptic Device Client: carrier \"%s\" not allowed for the %s stream, failed to open!",
+               settings.carrier.c_str(),name.c_str());
+        return false;
+    }
+
+    QosStyle style;
+    if (!settings.packetPriority.empty() && !style.setPacketPriority(settings.packetPriority))
+    {
+        yError("*** Haptic Device Client: unknown packet priority \"%s\" for the %s stream, failed to open!",
+               settings.packetPriority.c_str(),name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::connectStream(const string &src, const string &dest,
+                                       const StreamSettings &settings)
+{
+    if (!Network::connect(src,dest,settings.carrier))
+        return false;
+
+    // priorities are applied to both the ends of the connection
+    if (!settings.packetPriority.empty() || (settings.threadPriority>=0) ||
+        (settings.threadPolicy>=0))
+    {
+        QosStyle style;
+        if (!settings.packetPriority.empty())
+            style.setPacketPriority(settings.packetPriority);
+        if (settings.threadPriority>=0)
+            style.setThreadPriority(settings.threadPriority);
+        if (settings.threadPolicy>=0)
+            style.setThreadPolicy(settings.threadPolicy);
+
+        if (!Network::setConnectionQos(src,dest,style,style))
+            yWarning("*** Haptic Device Client: unable to set the QoS of %s -> %s",
+                     src.c_str(),dest.c_str());
+    }
+
+    verifyStream(src,dest,settings);
+    return true;
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::verifyStream(const string &src, const string &dest,
+                                      const StreamSettings &settings)
+{
+    ContactStyle contactStyle;
+    contactStyle.quiet=true;
+    contactStyle.carrier=settings.carrier;
+    if (!Network::isConnected(src,dest,contactStyle))
+        yWarning("*** Haptic Device Client: %s -> %s is not running over %s",
+                 src.c_str(),dest.c_str(),settings.carrier.c_str());
+
+    QosStyle srcStyle,destStyle;
+    if (!Network::getConnectionQos(src,dest,srcStyle,destStyle))
+    {
+        if (verbosity>0)
+            yInfo("*** Haptic Device Client: %s stream %s -> %s over %s, QoS not available",
+                  settings.name.c_str(),src.c_str(),dest.c_str(),settings.carrier.c_str());
+        return;
+    }
+
+    QosStyle expected;
+    if (!settings.packetPriority.empty())
+    {
+        expected.setPacketPriority(settings.packetPriority);
+        if ((srcStyle.getPacketPriorityAsTOS()!=expected.getPacketPriorityAsTOS()) ||
+            (destStyle.getPacketPriorityAsTOS()!=expected.getPacketPriorityAsTOS()))
+            yWarning("*** Haptic Device Client: %s -> %s has TOS %d/%d instead of %d",
+                     src.c_str(),dest.c_str(),srcStyle.getPacketPriorityAsTOS(),
+                     destStyle.getPacketPriorityAsTOS(),expected.getPacketPriorityAsTOS());
+    }
+
+    if ((settings.threadPriority>=0) &&
+        ((srcStyle.getThreadPriority()!=settings.threadPriority) ||
+         (destStyle.getThreadPriority()!=settings.threadPriority)))
+        yWarning("*** Haptic Device Client: %s -> %s has thread priority %d/%d instead of %d",
+                 src.c_str(),dest.c_str(),srcStyle.getThreadPriority(),
+                 destStyle.getThreadPriority(),settings.threadPriority);
+
+    if (verbosity>0)
+        yInfo("*** Haptic Device Client: %s stream %s -> %s over %s, TOS %d/%d, thread priority %d/%d",
+              settings.name.c_str(),src.c_str(),dest.c_str(),settings.carrier.c_str(),
+              srcStyle.getPacketPriorityAsTOS(),destStyle.getPacketPriorityAsTOS(),
+              srcStyle.getThreadPriority(),destStyle.getThreadPriority());
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::connectTo(const string &remote)
+{
+    // every connection goes through its own exchanges with the
+    // name server and the wrapper, hence they are set up together;
+    // a wrapper that is not running is not registered, and its
+    // connections fail without waiting for any timeout; the
+    // asynchronous channel and the events are optional, as older
+    // wrappers lack them
+    double t0=Time::now();
+    future<bool> connected[]={
+        async(launch::async,[&](){ return connectStream(remote+stateSource,statePort.getName(),stateStream); }),
+        async(launch::async,[&](){ return connectStream(feedbackPort.getName(),remote+"/feedback:i",feedbackStream); }),
+        async(launch::async,[&](){ return connectStream(rpcPort.getName(),remote+"/rpc",rpcStream); }),
+        async(launch::async,[&](){ return connectStream(asyncPort.getName(),remote+"/async:i",rpcStream); }),
+        async(launch::async,[&](){ return connectStream(remote+"/async:o",asyncReplyPort.getName(),rpcStream); }),
+        async(launch::async,[&](){ return connectStream(remote+"/events:o",eventPort.getName(),rpcStream); })
+    };
+    bool results[6];
+    for (size_t i=0; i<6; i++)
+        results[i]=connected[i].get();
+    connectTime=Time::now()-t0;
+
+    bool ok=results[0] && results[1] && results[2];
+    bool asyncOk=results[3] && results[4];
+    if (!ok)
+    {
+        if (verbosity>0)
+            yInfo("*** Haptic Device Client: unable to connect to %s",remote.c_str());
+        disconnectFrom(remote);
+        return false;
+    }
+
+    // half of the asynchronous channel would be of no use
+    if (results[3]!=results[4])
+    {
+        Network::disconnect(asyncPort.getName(),remote+"/async:i");
+        Network::disconnect(remote+"/async:o",asyncReplyPort.getName());
+    }
+
+    {
+        std::lock_guard lg(asyncMutex);
+        asyncEnabled=asyncOk;
+    }
+
+    if (!asyncOk && (verbosity>0))
+        yInfo("*** Haptic Device Client: asynchronous requests not available from %s",
+              remote.c_str());
+
+    // the events are optional as well, and get numbered anew by each wrapper
+    {
+        std::lock_guard lg(eventMutex);
+        lastEventSequence=-1;
+    }
+    if (!results[5] && (verbosity>0))
+        yInfo("*** Haptic Device Client: button events not available from %s",
+              remote.c_str());
+
+    if (!stateTier.empty())
+        adaptStaleTimeout(remote);
+
+    return true;
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::adaptStaleTimeout(const string &remote)
+{
+    // a tier slower than the timeout would be deemed stale between
+    // any two samples, hence the timeout follows its actual rate
+    if (staleTimeoutOption==0.0)
+        return;
+
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::get_stats);
+    double rate=0.0;
+    if (rpc(cmd,rep) && (rep.get(0).asVocab32()==hapticdevice::ack))
+    {
+        for (size_t i=1; i<rep.size(); i++)
+        {
+            Bottle *list=rep.get(i).asList();
+            if ((list==nullptr) || (list->get(0).asString()!="tiers"))
+                continue;
+
+            for (size_t j=1; j<list->size(); j++)
+            {
+                Bottle *tier=list->get(j).asList();
+                if ((tier!=nullptr) && (tier->get(0).asString()==stateTier))
+                    rate=tier->get(1).asFloat64();
+            }
+        }
+    }
+
+    if (rate<=0.0)
+    {
+        if (verbosity>0)
+            yInfo("*** Haptic Device Client: rate of tier %s not available from %s",
+                  stateTier.c_str(),remote.c_str());
+        return;
+    }
+
+    double timeout=HAPTICDEVICE_CLIENT_STALE_PERIODS/rate;
+    if (staleTimeoutOption<0.0)
+        staleTimeout=std::max(HAPTICDEVICE_CLIENT_STALE_TIMEOUT,timeout);
+    else if (staleTimeoutOption<timeout)
+    {
+        yWarning("*** Haptic Device Client: stale-timeout %g [s] too short for tier %s at %g Hz, using %g [s]",
+                 staleTimeoutOption,stateTier.c_str(),rate,timeout);
+        staleTimeout=timeout;
+    }
+    else
+        staleTimeout=staleTimeoutOption;
+
+    if (monitor.isRunning())
+        monitor.setPeriod(std::max(0.01,0.25*staleTimeout));
+    if (verbosity>0)
+        yInfo("*** Haptic Device Client: tier %s at %g Hz, stale-timeout %g [s]",
+              stateTier.c_str(),rate,staleTimeout.load());
+}
+
+
+/*********************************************************************/
+void InputSources::report(const PortInfo &info)
+{
+    if ((info.tag==PortInfo::PORTINFO_CONNECTION) && info.incoming)
+        names.push_back(info.sourceName);
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::disconnectInputs(Contactable &port)
+{
+    InputSources sources;
+    port.getReport(sources);
+    for (auto &source:sources.names)
+        Network::disconnect(source,port.getName());
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::disconnectFrom(const string &remote)
+{
+    Network::disconnect((remote+stateSource).c_str(),statePort.getName().c_str());
+    Network::disconnect(feedbackPort.getName().c_str(),(remote+"/feedback:i").c_str());
+    Network::disconnect(rpcPort.getName().c_str(),(remote+"/rpc").c_str());
+    Network::disconnect(asyncPort.getName().c_str(),(remote+"/async:i").c_str());
+    Network::disconnect((remote+"/async:o").c_str(),asyncReplyPort.getName().c_str());
+    Network::disconnect((remote+"/events:o").c_str(),eventPort.getName().c_str());
+
+    // the wrapper may have moved the connections over to ports of
+    // their own, e.g. /state/<n>:o in latest publish mode
+    disconnectInputs(statePort);
+    disconnectInputs(asyncReplyPort);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::reconnect()
+{
+    // nothing is locked that the getters need, hence they keep
+    // serving the last sample while this goes on
+    size_t current;
+    {
+        std::lock_guard lg(remoteMutex);
+        current=activeRemote;
+    }
+
+    disconnectFrom(remotes[current]);
+    failPending();
+
+    // start over with the active wrapper, which might have just
+    // been restarted, then move on to the standby ones
+    for (size_t i=0; i<remotes.size(); i++)
+    {
+        size_t candidate=(current+i)%remotes.size();
+        if (connectTo(remotes[candidate]))
+        {
+            {
+                std::lock_guard lg(remoteMutex);
+                activeRemote=candidate;
+            }
+
+            // whatever was learnt about the previous wrapper is void
+            configEpoch=-1;
+            invalidateCache();
+            clockSync.reset();
+            {
+                std::lock_guard lg(historyMutex);
+                history.clear();
+            }
+            {
+                std::lock_guard lg(mutex);
+                predictor.reset();
+            }
+
+            if (verbosity>0)
+                yInfo("*** Haptic Device Client: connected to %s",
+                      remotes[candidate].c_str());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getPosition(Vector &pos)
+{
+    hapticdevice::HapticState state;
+    getState(state);
+    pos.resize(3);
+    std::copy(state.position,state.position+3,pos.begin());
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getOrientation(Vector &rpy)
+{
+    hapticdevice::HapticState state;
+    getState(state);
+    rpy.resize(3);
+    std::copy(state.orientation,state.orientation+3,rpy.begin());
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getButtons(Vector &buttons)
+{
+    hapticdevice::HapticState state;
+    getState(state);
+    buttons.resize(2);
+    std::copy(state.buttons,state.buttons+2,buttons.begin());
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::isCartesianForceModeEnabled(bool &ret)
+{
+    int epoch=configEpoch;
+    if (lookupCartesian(epoch,ret))
+        return true;
+
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::is_cartesian);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseCartesian(rep,epoch,ret);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::setCartesianForceMode()
+{
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::set_cartesian);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseAck(rep,true);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::setJointTorqueMode()
+{
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::set_joint);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseAck(rep,true);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getMaxFeedback(Vector &max)
+{
+    int epoch=configEpoch;
+    if (lookupMaxFeedback(epoch,max))
+        return true;
+
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::get_max);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseMaxFeedback(rep,epoch,max);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::setFeedback(const Vector &fdbck)
+{
+    if (fdbck.length()==3)
+    {
+        if (feedbackSender.isRunning())
+            feedbackSender.post(fdbck);
+        else
+        {
+            feedbackPort.prepare()=fdbck;
+            feedbackPort.writeStrict();
+        }
+        return true;
+    }
+    else
+        return false;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::stopFeedback()
+{
+    // forces still pending must not outlive the stop
+    feedbackSender.discard();
+
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::stop_feedback);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseAck(rep,false);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getTransformation(Matrix &T)
+{
+    int epoch=configEpoch;
+    if (lookupTransformation(epoch,T))
+        return true;
+
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::get_transformation);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseTransformation(rep,epoch,T);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::setTransformation(const Matrix &T)
+{
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::set_transformation);
+    cmd.addList().read(const_cast<Matrix&>(T));
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    return parseAck(rep,true);
+}
+
+
+/*********************************************************************/
+Stamp HapticDeviceClient::getLastInputStamp()
+{
+    hapticdevice::HapticState state;
+    if (!getState(state))
+        return Stamp();
+
+    return Stamp(state.sequence,state.stamp);
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::invalidateCache()
+{
+    std::lock_guard lg(cacheMutex);
+    cache.invalidate();
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::lookupCartesian(const int epoch, bool &ret)
+{
+    if (!cacheEnabled || (epoch<0))
+        return false;
+
+    std::lock_guard lg(cacheMutex);
+    if (cache.cartesianEpoch!=epoch)
+        return false;
+
+    ret=cache.cartesian;
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::lookupMaxFeedback(const int epoch, Vector &max)
+{
+    if (!cacheEnabled || (epoch<0))
+        return false;
+
+    std::lock_guard lg(cacheMutex);
+    if (cache.maxFeedbackEpoch!=epoch)
+        return false;
+
+    max=cache.maxFeedback;
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::lookupTransformation(const int epoch, Matrix &T)
+{
+    if (!cacheEnabled || (epoch<0))
+        return false;
+
+    std::lock_guard lg(cacheMutex);
+    if (cache.transformationEpoch!=epoch)
+        return false;
+
+    T=cache.transformation;
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::parseAck(const Bottle &rep, const bool reconfigured)
+{
+    if (rep.get(0).asVocab32()!=hapticdevice::ack)
+        return false;
+
+    if (reconfigured)
+        invalidateCache();
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::parseCartesian(const Bottle &rep, const int epoch,
+                                        bool &ret)
+{
+    if (rep.get(0).asVocab32()==hapticdevice::ack)
+    {
+        ret=(rep.get(1).asInt32()!=0);
+
+        std::lock_guard lg(cacheMutex);
+        cache.cartesian=ret;
+        cache.cartesianEpoch=epoch;
+        return true;
+    }
+    else
+        return false;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::parseMaxFeedback(const Bottle &rep, const int epoch,
+                                          Vector &max)
+{
+    if (rep.get(0).asVocab32()==hapticdevice::ack)
+    {
+        if (Bottle *payload=rep.get(1).asList())
+        {
+            max.resize(payload->size());
+            for (size_t i=0; i<max.length(); i++)
+                max[i]=payload->get(i).asFloat64();
+
+            std::lock_guard lg(cacheMutex);
+            cache.maxFeedback=max;
+            cache.maxFeedbackEpoch=epoch;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::parseTransformation(const Bottle &rep, const int epoch,
+                                             Matrix &T)
+{
+    if (rep.get(0).asVocab32()==hapticdevice::ack)
+    {
+        if (Bottle *payload=rep.get(1).asList())
+        {
+            T.resize(payload->get(0).asInt32(),
+                     payload->get(1).asInt32());
+
+            if (Bottle *vals=payload->get(2).asList())
+            {
+                for (int r=0; r<T.rows(); r++)
+                    for (int c=0; c<T.cols(); c++)
+                        T(r,c)=vals->get(T.rows()*r+c).asFloat64();
+
+                std::lock_guard lg(cacheMutex);
+                cache.transformation=T;
+                cache.transformationEpoch=epoch;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::rpc(Bottle &cmd, Bottle &rep)
+{
+    std::lock_guard lg(rpcMutex);
+    return rpcPort.write(cmd,rep);
+}
+
+
+/*********************************************************************/
+double HapticDeviceClient::predictionSpan()
+{
+    // once the clocks are synchronized, the extrapolation starts off
+    // from when the sample was acquired rather than when it arrived
+    double t0=arrival;
+    clockSync.toLocal(predictor.getTime(),t0);
+    return std::max(0.0,std::min(Time::now()-t0,predictionHorizon));
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::predict(double *xp)
+{
+    std::lock_guard lg(mutex);
+    if ((predictionHorizon<=0.0) || !predictor.isValid())
+        return false;
+
+    predictor.predict(xp,predictionSpan());
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getPredictedPosition(Vector &pos)
+{
+    double xp[6];
+    if (!predict(xp))
+        return false;
+
+    pos.resize(3);
+    std::copy(xp,xp+3,pos.begin());
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getPredictedOrientation(Vector &rpy)
+{
+    double xp[6];
+    if (!predict(xp))
+        return false;
+
+    rpy.resize(3);
+    std::copy(xp+3,xp+6,rpy.begin());
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getPredictionAge(double &age)
+{
+    std::lock_guard lg(mutex);
+    if ((predictionHorizon<=0.0) || !predictor.isValid())
+        return false;
+
+    age=predictionSpan();
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getClockOffset(double &offset, double &drift)
+{
+    return clockSync.getOffset(Time::now(),offset,drift);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::toLocalTime(const double remote, double &local)
+{
+    return clockSync.toLocal(remote,local);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getSampleAge(double &age)
+{
+    hapticdevice::HapticState state;
+    double t;
+    if (!getState(state) || !clockSync.toLocal(state.stamp,t))
+        return false;
+
+    age=Time::now()-t;
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getState(hapticdevice::HapticState &state)
 {
-    if (client!=NULL)
-    {
-        std::lock_guard lg(client->mutex);
-        state.write(client->state);
-        getEnvelope(client->stamp);
-    }
+    return this->state.load(state);
 }
 
 
 /*********************************************************************/
-HapticDeviceClient::HapticDeviceClient() : state(8,0.0)
+bool HapticDeviceClient::getStateAt(const double t,
+                                    hapticdevice::HapticState &state)
 {
+    std::lock_guard lg(historyMutex);
+    return history.lookup(t,state);
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::open(Searchable &config)
+bool HapticDeviceClient::waitForNextState(hapticdevice::HapticState &state,
+                                          const double timeout)
 {
-    if (!config.check("remote"))
     {
-        yError("*** Haptic Device Client: \"remote\" option missing, failed to open!");
-        return false;
+        std::unique_lock lck(waitMutex);
+        unsigned long generation0=generation;
+        auto fresh=[&]() { return closing || (generation!=generation0); };
+        if (timeout>0.0)
+        {
+            if (!waitCondition.wait_for(lck,std::chrono::duration<double>(timeout),fresh))
+                return false;
+        }
+        else
+            waitCondition.wait(lck,fresh);
+
+        if (closing)
+            return false;
     }
 
-    if (!config.check("local"))
+    return getState(state);
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::receive(const Bottle &events)
+{
     {
-        yError("*** Haptic Device Client: \"local\" option missing, failed to open!");
-        return false;
+        std::lock_guard lg(eventMutex);
+        for (size_t i=0; i<events.size(); i++)
+        {
+            // (<sequence> <button> <pressed> <stamp>)
+            Bottle *e=events.get(i).asList();
+            if ((e==NULL) || (e->size()<4))
+                continue;
+
+            int sequence=e->get(0).asInt32();
+            if ((lastEventSequence>=0) && (sequence>lastEventSequence+1))
+                lostEvents+=sequence-lastEventSequence-1;
+            lastEventSequence=sequence;
+
+            if (this->events.size()>=eventQueueSize)
+            {
+                this->events.pop_front();
+                lostEvents++;
+            }
+
+            hapticdevice::ButtonEvent event;
+            event.button=e->get(1).asInt32();
+            event.pressed=(e->get(2).asInt32()!=0);
+            event.stamp=e->get(3).asFloat64();
+            this->events.push_back(event);
+        }
     }
+    eventCondition.notify_all();
+}
 
-    string remote=config.find("remote").asString().c_str();
-    string local=config.find("local").asString().c_str();
-    verbosity=config.check("verbosity",Value(0)).asInt32();
 
-    statePort.open((local+"/state:i").c_str());
-    feedbackPort.open((local+"/feedback:o").c_str());
-    rpcPort.open((local+"/rpc").c_str());
-    statePort.setClient(this);
+/*********************************************************************/
+bool HapticDeviceClient::getButtonEvent(hapticdevice::ButtonEvent &event)
+{
+    std::lock_guard lg(eventMutex);
+    if (events.empty())
+        return false;
 
-    bool ok=true;
-    ok&=Network::connect((remote+"/state:o").c_str(),statePort.getName().c_str(),"udp");
-    ok&=Network::connect(feedbackPort.getName().c_str(),(remote+"/feedback:i").c_str(),"tcp");
-    ok&=Network::connect(rpcPort.getName().c_str(),(remote+"/rpc").c_str(),"tcp");
+    event=events.front();
+    events.pop_front();
+    return true;
+}
 
-    if (!ok)
+
+/*********************************************************************/
+bool HapticDeviceClient::waitForButtonEvent(hapticdevice::ButtonEvent &event,
+                                            const double timeout)
+{
+    std::unique_lock lck(eventMutex);
+    auto available=[&]() { return eventsClosing || !events.empty(); };
+    if (timeout>0.0)
     {
-        statePort.close();
-        feedbackPort.close();
-        rpcPort.close();
+        if (!eventCondition.wait_for(lck,std::chrono::duration<double>(timeout),available))
+            return false;
+    }
+    else
+        eventCondition.wait(lck,available);
 
-        yError("*** Haptic Device Client: unable to connect to Haptic Device Wrapper, failed to open!");
+    if (events.empty())
         return false;
-    }
 
-    if (verbosity>0)
-        yInfo("*** Haptic Device Client: opened");
+    event=events.front();
+    events.pop_front();
+    return true;
+}
+
 
+/*********************************************************************/
+bool HapticDeviceClient::getLostButtonEvents(unsigned long &lost)
+{
+    std::lock_guard lg(eventMutex);
+    lost=lostEvents;
     return true;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::close()
+bool HapticDeviceClient::registerStateCallback(hapticdevice::HapticStateCallback *callback)
 {
-    statePort.close();
-    feedbackPort.close();
-    rpcPort.close();
+    if (callback==NULL)
+        return false;
 
-    if (verbosity>0)
-        yInfo("*** Haptic Device Client: closed");
+    std::lock_guard lg(callbackMutex);
+    if (std::find(callbacks.begin(),callbacks.end(),callback)!=callbacks.end())
+        return false;
 
+    callbacks.push_back(callback);
     return true;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::getPosition(Vector &pos)
+bool HapticDeviceClient::unregisterStateCallback(hapticdevice::HapticStateCallback *callback)
 {
-    std::lock_guard lg(mutex);
-    pos=state.subVector(0,2);
+    std::unique_lock<std::mutex> lck(callbackMutex);
+    auto it=std::find(callbacks.begin(),callbacks.end(),callback);
+    if (it==callbacks.end())
+        return false;
+
+    callbacks.erase(it);
+    if (dispatcher==std::this_thread::get_id())
+    {
+        // called from within a callback, which cannot be waited for:
+        // the rest of the ongoing round skips the unregistered one
+        std::replace(dispatching.begin(),dispatching.end(),callback,
+                     (hapticdevice::HapticStateCallback*)nullptr);
+    }
+    else if (dispatcher!=std::thread::id())
+    {
+        // the rounds starting from now on do not include it anymore
+        unsigned long round=dispatchRounds;
+        callbackCondition.wait(lck,[&]() { return dispatchRounds!=round; });
+    }
+
     return true;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::getOrientation(Vector &rpy)
+bool HapticDeviceClient::post(Bottle &cmd,
+                              std::function<void(const Bottle*)> handler)
 {
-    std::lock_guard lg(mutex);
-    rpy=state.subVector(3,5);
+    int id;
+    {
+        std::lock_guard lg(asyncMutex);
+        if (!asyncEnabled || (asyncPort.getOutputCount()==0))
+            return false;
+
+        id=nextRequestId++;
+        pending[id]={std::move(handler),
+                     (asyncTimeout>0.0)?Time::now()+asyncTimeout:0.0};
+    }
+
+    // the writing is left to the sender, so that the caller never
+    // waits for the previous requests; a full backlog is refused
+    if (!requestSender.push(id,cmd))
+    {
+        std::lock_guard lg(asyncMutex);
+        pending.erase(id);
+        return false;
+    }
+
     return true;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::getButtons(Vector &buttons)
+std::future<bool> HapticDeviceClient::postAck(Bottle &cmd, const bool reconfigured)
 {
-    std::lock_guard lg(mutex);
-    buttons=state.subVector(6,7);
-    return true;
+    auto promise=std::make_shared<std::promise<bool>>();
+    std::future<bool> future=promise->get_future();
+
+    if (!post(cmd,[this,promise,reconfigured](const Bottle *rep) {
+            promise->set_value((rep!=NULL) && parseAck(*rep,reconfigured));
+        }))
+        promise->set_value(false);
+
+    return future;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::isCartesianForceModeEnabled(bool &ret)
+void HapticDeviceClient::complete(const int id, const Bottle *rep)
 {
-    Bottle cmd,rep;
-    cmd.addVocab32(hapticdevice::is_cartesian);
-    if (!rpcPort.write(cmd,rep))
+    std::function<void(const Bottle*)> handler;
     {
-        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
-        return false;
+        std::lock_guard lg(asyncMutex);
+        auto it=pending.find(id);
+        if (it==pending.end())
+            return;
+
+        handler=std::move(it->second.handler);
+        pending.erase(it);
     }
 
-    if (rep.get(0).asVocab32()==hapticdevice::ack)
+    handler(rep);
+}
+
+
+/*********************************************************************/
+void HapticDeviceClient::expirePending(const double now)
+{
+    // the handlers are called outside the lock, as in complete()
+    vector<std::function<void(const Bottle*)>> expired;
     {
-        ret=(rep.get(1).asInt32()!=0);
-        return true;
+        std::lock_guard lg(asyncMutex);
+        for (auto it=pending.begin(); it!=pending.end();)
+        {
+            if ((it->second.deadline>0.0) && (now>=it->second.deadline))
+            {
+                expired.push_back(std::move(it->second.handler));
+                it=pending.erase(it);
+            }
+            else
+                it++;
+        }
     }
-    else
-        return false;
+
+    if (!expired.empty() && (verbosity>0))
+        yWarning("*** Haptic Device Client: %zu asynchronous requests timed out",
+                 expired.size());
+
+    for (auto &handler:expired)
+        handler(NULL);
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::setCartesianForceMode()
+void HapticDeviceClient::failPending()
 {
-    Bottle cmd,rep;
-    cmd.addVocab32(hapticdevice::set_cartesian);
-    if (!rpcPort.write(cmd,rep))
+    std::map<int,PendingRequest> orphans;
     {
-        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
-        return false;
+        std::lock_guard lg(asyncMutex);
+        asyncEnabled=false;
+        orphans.swap(pending);
     }
 
-    return (rep.get(0).asVocab32()==hapticdevice::ack);
+    for (auto &orphan:orphans)
+        orphan.second.handler(NULL);
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::setJointTorqueMode()
+std::future<std::optional<bool>> HapticDeviceClient::isCartesianForceModeEnabledAsync()
 {
-    Bottle cmd,rep;
+    auto promise=std::make_shared<std::promise<std::optional<bool>>>();
+    std::future<std::optional<bool>> future=promise->get_future();
+
+    int epoch=configEpoch;
+    bool ret;
+    if (lookupCartesian(epoch,ret))
+    {
+        promise->set_value(ret);
+        return future;
+    }
+
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::is_cartesian);
+    if (!post(cmd,[this,promise,epoch](const Bottle *rep) {
+            bool ret;
+            if ((rep!=NULL) && parseCartesian(*rep,epoch,ret))
+                promise->set_value(ret);
+            else
+                promise->set_value(std::nullopt);
+        }))
+        promise->set_value(std::nullopt);
+
+    return future;
+}
+
+
+/*********************************************************************/
+std::future<bool> HapticDeviceClient::setCartesianForceModeAsync()
+{
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::set_cartesian);
+    return postAck(cmd,true);
+}
+
+
+/*********************************************************************/
+std::future<bool> HapticDeviceClient::setJointTorqueModeAsync()
+{
+    Bottle cmd;
     cmd.addVocab32(hapticdevice::set_joint);
-    if (!rpcPort.write(cmd,rep))
+    return postAck(cmd,true);
+}
+
+
+/*********************************************************************/
+std::future<std::optional<Vector>> HapticDeviceClient::getMaxFeedbackAsync()
+{
+    auto promise=std::make_shared<std::promise<std::optional<Vector>>>();
+    std::future<std::optional<Vector>> future=promise->get_future();
+
+    int epoch=configEpoch;
+    Vector max;
+    if (lookupMaxFeedback(epoch,max))
     {
-        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
-        return false;
+        promise->set_value(max);
+        return future;
     }
 
-    return (rep.get(0).asVocab32()==hapticdevice::ack);
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::get_max);
+    if (!post(cmd,[this,promise,epoch](const Bottle *rep) {
+            Vector max;
+            if ((rep!=NULL) && parseMaxFeedback(*rep,epoch,max))
+                promise->set_value(max);
+            else
+                promise->set_value(std::nullopt);
+        }))
+        promise->set_value(std::nullopt);
+
+    return future;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::getMaxFeedback(Vector &max)
+std::future<bool> HapticDeviceClient::stopFeedbackAsync()
+{
+    feedbackSender.discard();
+
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::stop_feedback);
+    return postAck(cmd,false);
+}
+
+
+/*********************************************************************/
+std::future<std::optional<Matrix>> HapticDeviceClient::getTransformationAsync()
+{
+    auto promise=std::make_shared<std::promise<std::optional<Matrix>>>();
+    std::future<std::optional<Matrix>> future=promise->get_future();
+
+    int epoch=configEpoch;
+    Matrix T;
+    if (lookupTransformation(epoch,T))
+    {
+        promise->set_value(T);
+        return future;
+    }
+
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::get_transformation);
+    if (!post(cmd,[this,promise,epoch](const Bottle *rep) {
+            Matrix T;
+            if ((rep!=NULL) && parseTransformation(*rep,epoch,T))
+                promise->set_value(T);
+            else
+                promise->set_value(std::nullopt);
+        }))
+        promise->set_value(std::nullopt);
+
+    return future;
+}
+
+
+/*********************************************************************/
+std::future<bool> HapticDeviceClient::setTransformationAsync(const Matrix &T)
+{
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::set_transformation);
+    cmd.addList().read(const_cast<Matrix&>(T));
+    return postAck(cmd,true);
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::isStateStale(bool &stale)
+{
+    stale=this->stale;
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getActiveRemote(string &remote)
+{
+    std::lock_guard lg(remoteMutex);
+    remote=remotes[activeRemote];
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::getRecoveryTime(double &last, double &worst)
+{
+    if (lastRecovery<0.0)
+        return false;
+
+    last=lastRecovery;
+    worst=worstRecovery;
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceClient::setMesh(const vector<double> &vertices,
+                                 const vector<int> &triangles)
 {
     Bottle cmd,rep;
-    cmd.addVocab32(hapticdevice::get_max);
-    if (!rpcPort.write(cmd,rep))
+    cmd.addVocab32(hapticdevice::set_mesh);
+    Bottle &v=cmd.addList();
+    for (auto x:vertices)
+        v.addFloat64(x);
+    Bottle &t=cmd.addList();
+    for (auto i:triangles)
+        t.addInt32(i);
+
+    if (!rpc(cmd,rep))
     {
         yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
         return false;
     }
 
-    if (rep.get(0).asVocab32()==hapticdevice::ack)
+    if (rep.get(0).asVocab32()!=hapticdevice::ack)
     {
-        if (Bottle *payload=rep.get(1).asList())
-        {
-            max.resize(payload->size());
-            for (size_t i=0; i<max.length(); i++)
-                max[i]=payload->get(i).asFloat64();
-
-            return true;
-        }
+        if (rep.size()>1)
+            yError("*** Haptic Device Client: mesh refused (%s)",
+                   rep.get(1).asString().c_str());
+        return false;
     }
 
-    return false;
+    return true;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::setFeedback(const Vector &fdbck)
+bool HapticDeviceClient::clearMesh()
 {
-    if (fdbck.length()==3)
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::clear_mesh);
+    if (!rpc(cmd,rep))
     {
-        feedbackPort.prepare().read(const_cast<Vector&>(fdbck));
-        feedbackPort.writeStrict();
-        return true;
-    }
-    else
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
         return false;
+    }
+
+    return parseAck(rep,false);
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::stopFeedback()
+bool HapticDeviceClient::setContactParameters(const double stiffness,
+                                              const double damping)
 {
     Bottle cmd,rep;
-    cmd.addVocab32(hapticdevice::stop_feedback);
-    if (!rpcPort.write(cmd,rep))
+    cmd.addVocab32(hapticdevice::set_contact);
+    cmd.addFloat64(stiffness);
+    cmd.addFloat64(damping);
+    if (!rpc(cmd,rep))
     {
         yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
         return false;
     }
 
-    return (rep.get(0).asVocab32()==hapticdevice::ack);
+    return parseAck(rep,false);
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::getTransformation(Matrix &T)
+bool HapticDeviceClient::getContact(bool &contact, Vector &proxy,
+                                    Vector &force)
 {
     Bottle cmd,rep;
-    cmd.addVocab32(hapticdevice::get_transformation);
-    if (!rpcPort.write(cmd,rep))
+    cmd.addVocab32(hapticdevice::get_contact);
+    if (!rpc(cmd,rep))
     {
         yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
         return false;
     }
 
-    if (rep.get(0).asVocab32()==hapticdevice::ack)
-    {
-        if (Bottle *payload=rep.get(1).asList())
-        {
-            T.resize(payload->get(0).asInt32(),
-                     payload->get(1).asInt32());
-
-            if (Bottle *vals=payload->get(2).asList())
-            {
-                for (int r=0; r<T.rows(); r++)
-                    for (int c=0; c<T.cols(); c++)
-                        T(r,c)=vals->get(T.rows()*r+c).asFloat64();
+    // [ack] <contact> (<proxy>) (<force>) <worst> <exhausted>
+    Bottle *p=rep.get(2).asList();
+    Bottle *f=rep.get(3).asList();
+    if ((rep.get(0).asVocab32()!=hapticdevice::ack) || (p==NULL) || (f==NULL) ||
+        (p->size()<3) || (f->size()<3))
+        return false;
 
-                return true;
-            }
-        }
+    contact=(rep.get(1).asInt32()!=0);
+    proxy.resize(3);
+    force.resize(3);
+    for (size_t i=0; i<3; i++)
+    {
+        proxy[i]=p->get(i).asFloat64();
+        force[i]=f->get(i).asFloat64();
     }
-
-    return false;
+    return true;
 }
 
 
 /*********************************************************************/
-bool HapticDeviceClient::setTransformation(const Matrix &T)
+bool HapticDeviceClient::getRenderStats(double &worst, int &exhausted)
 {
     Bottle cmd,rep;
-    cmd.addVocab32(hapticdevice::set_transformation);
-    cmd.addList().read(const_cast<Matrix&>(T));
-    if (!rpcPort.write(cmd,rep))
+    cmd.addVocab32(hapticdevice::get_contact);
+    if (!rpc(cmd,rep))
     {
         yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
         return false;
     }
 
-    return (rep.get(0).asVocab32()==hapticdevice::ack);
+    if ((rep.get(0).asVocab32()!=hapticdevice::ack) || (rep.size()<6))
+        return false;
+
+    worst=rep.get(4).asFloat64();
+    exhausted=rep.get(5).asInt32();
+    return true;
 }
 
 
 /*********************************************************************/
-Stamp HapticDeviceClient::getLastInputStamp()
+bool HapticDeviceClient::getPassivity(double &energy, double &damping,
+                                      double &dissipated, int &active)
 {
-    std::lock_guard lg(mutex);
-    return stamp;
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::get_passivity);
+    if (!rpc(cmd,rep))
+    {
+        yError("*** Haptic Device Client: unable to get reply from Haptic Device Wrapper!");
+        return false;
+    }
+
+    // [ack] <energy> <damping> <dissipated> <active>
+    if ((rep.get(0).asVocab32()!=hapticdevice::ack) || (rep.size()<5))
+        return false;
+
+    energy=rep.get(1).asFloat64();
+    damping=rep.get(2).asFloat64();
+    dissipated=rep.get(3).asFloat64();
+    active=rep.get(4).asInt32();
+    return true;
 }
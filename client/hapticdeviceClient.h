@@ -11,10 +11,23 @@
 #define __HAPTICDEVICE_CLIENT__
 
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <optional>
 
+#include <yarp/os/PeriodicThread.h>
 #include <yarp/os/RpcClient.h>
 #include <yarp/os/BufferedPort.h>
 #include <yarp/os/Bottle.h>
+#include <yarp/os/PortReport.h>
+#include <yarp/os/PortInfo.h>
 #include <yarp/os/Stamp.h>
 #include <yarp/dev/DeviceDriver.h>
 #include <yarp/dev/IPreciselyTimed.h>
@@ -22,12 +35,17 @@
 #include <yarp/sig/Vector.h>
 #include <yarp/sig/Matrix.h>
 
+#include "IHapticDeviceClient.h"
+#include "IHapticRenderer.h"
+#include "IHapticPassivity.h"
+#include "IHapticButtonEvents.h"
+
 class HapticDeviceClient;
 
-class StatePort : public yarp::os::BufferedPort<yarp::os::Bottle>
+class StatePort : public yarp::os::BufferedPort<yarp::sig::Vector>
 {
     HapticDeviceClient *client;
-    void onRead(yarp::os::Bottle &state);
+    void onRead(yarp::sig::Vector &state);
 
 public:
     StatePort() : client(NULL)
@@ -42,25 +60,450 @@ public:
 };
 
 
+/**
+ * Stream of the replies to the asynchronous requests, retaining only
+ * those addressed to this client.
+ */
+class AsyncReplyPort : public yarp::os::BufferedPort<yarp::os::Bottle>
+{
+    HapticDeviceClient *client;
+    void onRead(yarp::os::Bottle &reply);
+
+public:
+    AsyncReplyPort() : client(NULL)
+    {
+        useCallback();
+    }
+
+    void setClient(HapticDeviceClient *client_)
+    {
+        this->client=client_;
+    }
+};
+
+
+/**
+ * Receiver of the button events.
+ */
+class EventPort : public yarp::os::BufferedPort<yarp::os::Bottle>
+{
+    HapticDeviceClient *client;
+    void onRead(yarp::os::Bottle &events);
+
+public:
+    EventPort() : client(NULL)
+    {
+        useCallback();
+    }
+
+    void setClient(HapticDeviceClient *client_)
+    {
+        this->client=client_;
+    }
+};
+
+
+/**
+ * Single-writer sequence lock holding the latest state, which lets
+ * readers take consistent snapshots without locks.
+ */
+class StateSeqLock
+{
+    static const int size=10;
+    std::atomic<unsigned int> seq{0};
+    std::atomic<double> data[size];
+
+public:
+    StateSeqLock()
+    {
+        for (auto &d:data)
+            d.store(0.0);
+    }
+
+    void store(const hapticdevice::HapticState &state);
+    bool load(hapticdevice::HapticState &state) const;
+};
+
+
+/**
+ * Bounded ring of time-stamped samples, whose stamps are kept apart
+ * in a contiguous array so that lookups by time are binary searches
+ * touching only a few cache lines.
+ */
+class StateHistory
+{
+    std::vector<double> stamps;
+    std::vector<hapticdevice::HapticState> samples;
+    size_t mask,head,count;
+
+    size_t index(const size_t i) const { return (head+i)&mask; }
+
+public:
+    StateHistory();
+
+    void resize(const size_t capacity);
+    void clear();
+    void push(const hapticdevice::HapticState &state);
+    bool lookup(const double t, hapticdevice::HapticState &state) const;
+};
+
+
+/**
+ * Constant-velocity alpha-beta filter extrapolating the pose
+ * (position and orientation) of the device.
+ */
+class StatePredictor
+{
+    double alpha,beta;
+    double x[6],v[6];
+    double t;
+    bool valid;
+
+public:
+    StatePredictor();
+
+    void configure(const double alpha, const double beta);
+    void reset();
+    void update(const double *z, const double t);
+    void predict(double *xp, const double dt) const;
+    double getTime() const { return t; }
+    bool isValid() const { return valid; }
+};
+
+
+/**
+ * NTP-like estimation of the offset between the clock of the wrapper
+ * and the local clock, carried out through low-rate pings.
+ */
+class ClockSync : public yarp::os::PeriodicThread
+{
+    static const int window=8;
+
+    HapticDeviceClient *client;
+    std::mutex mutex;
+    double t[window],offset[window],rtt[window];
+    int n,head;
+
+    double estOffset,estDrift,tRef;
+
+    void run() override;
+
+public:
+    ClockSync();
+
+    void setClient(HapticDeviceClient *client_)
+    {
+        this->client=client_;
+    }
+
+    void reset();
+    void addSample(const double t1, const double t2,
+                   const double t3, const double t4);
+    bool getOffset(const double t, double &offset, double &drift);
+    bool toLocal(const double remote, double &local);
+};
+
+
+/**
+ * Watchdog on the freshness of the state stream, which reconnects
+ * to the wrapper, or fails over to a standby one, with exponential
+ * backoff whenever the samples stop flowing.
+ */
+class ConnectionMonitor : public yarp::os::PeriodicThread
+{
+    HapticDeviceClient *client;
+    double minBackoff,maxBackoff;
+    double backoff,nextAttempt;
+
+    void run() override;
+
+public:
+    ConnectionMonitor();
+
+    void setClient(HapticDeviceClient *client_)
+    {
+        this->client=client_;
+    }
+
+    void configure(const double minBackoff, const double maxBackoff);
+};
+
+
+/**
+ * Watchdog on the asynchronous requests, which fails those whose
+ * reply has not come back in time, e.g. because it got lost.
+ */
+class RequestTimer : public yarp::os::PeriodicThread
+{
+    HapticDeviceClient *client;
+
+    void run() override;
+
+public:
+    RequestTimer();
+
+    void setClient(HapticDeviceClient *client_)
+    {
+        this->client=client_;
+    }
+};
+
+
+/**
+ * Hand-over of the asynchronous requests to a thread of their own,
+ * which waits for each of them to be written in place of the caller.
+ * The backlog is bounded: the requests that do not fit are refused.
+ */
+class RequestSender
+{
+public:
+    static const size_t capacity=256;
+
+    RequestSender();
+    ~RequestSender();
+
+    void start(yarp::os::BufferedPort<yarp::os::Bottle> *port,
+               const std::string &replyTo);
+    void stop();
+    bool push(const int id, const yarp::os::Bottle &cmd);
+
+private:
+    struct Entry
+    {
+        int id;
+        yarp::os::Bottle cmd;
+    };
+
+    yarp::os::BufferedPort<yarp::os::Bottle> *port;
+    std::string replyTo;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Entry> queue;
+    bool stopping;
+
+    void loop();
+};
+
+
+/**
+ * Asynchronous request waiting for its reply.
+ */
+struct PendingRequest
+{
+    std::function<void(const yarp::os::Bottle*)> handler;
+    double deadline;
+};
+
+
+/**
+ * Rate-capped sender of the force feedback that coalesces the
+ * requests into the newest one, so that callers never wait for
+ * the network.
+ */
+class FeedbackSender : public yarp::os::PeriodicThread
+{
+    HapticDeviceClient *client;
+    std::mutex mutex;
+    double fdbck[3];
+    bool fresh;
+    unsigned long sent,coalesced;
+
+    void run() override;
+
+public:
+    FeedbackSender();
+
+    void setClient(HapticDeviceClient *client_)
+    {
+        this->client=client_;
+    }
+
+    void post(const yarp::sig::Vector &fdbck);
+    void discard();
+    void getStats(unsigned long &sent, unsigned long &coalesced);
+};
+
+
+/**
+ * Collector of the sources of the connections coming into a port.
+ */
+class InputSources : public yarp::os::PortReport
+{
+public:
+    std::vector<std::string> names;
+    void report(const yarp::os::PortInfo &info) override;
+};
+
+
+/**
+ * Transport and quality of service of one of the streams exchanged
+ * with the wrapper.
+ */
+struct StreamSettings
+{
+    std::string name;
+    std::string carrier;
+    std::string packetPriority;
+    int threadPriority{-1};
+    int threadPolicy{-1};
+};
+
+
+/**
+ * Slow-changing properties of the device along with the
+ * configuration epochs they are valid for.
+ */
+struct PropertyCache
+{
+    int maxFeedbackEpoch{-1};
+    yarp::sig::Vector maxFeedback;
+
+    int transformationEpoch{-1};
+    yarp::sig::Matrix transformation;
+
+    int cartesianEpoch{-1};
+    bool cartesian{false};
+
+    void invalidate()
+    {
+        maxFeedbackEpoch=transformationEpoch=cartesianEpoch=-1;
+    }
+};
+
+
 /**
  * Haptic Device client.
  */
 class HapticDeviceClient : public yarp::dev::DeviceDriver,
                            public yarp::dev::IPreciselyTimed,
-                           public yarp::dev::IHapticDevice
+                           public yarp::dev::IHapticDevice,
+                           public hapticdevice::IHapticDeviceClient,
+                           public hapticdevice::IHapticRenderer,
+                           public hapticdevice::IHapticPassivity,
+                           public hapticdevice::IHapticButtonEvents
 {
 protected:
     int verbosity;
 
     friend StatePort;
-    StatePort                                statePort;
-    yarp::os::BufferedPort<yarp::os::Bottle> feedbackPort;
-    yarp::os::RpcClient                      rpcPort;
+    friend ClockSync;
+    friend ConnectionMonitor;
+    friend FeedbackSender;
+    friend RequestTimer;
+    std::vector<std::string> remotes;
+    std::string stateTier;
+    std::string stateSource;
+    size_t activeRemote;
+    std::mutex remoteMutex;
+
+    double staleTimeoutOption;
+    std::atomic<double> staleTimeout;
+    std::atomic<double> lastArrival;
+    std::atomic<double> staleSince;
+    std::atomic<bool> stale;
+    std::atomic<double> lastRecovery;
+    std::atomic<double> worstRecovery;
+    ConnectionMonitor monitor;
+
+    StreamSettings stateStream;
+    StreamSettings feedbackStream;
+    StreamSettings rpcStream;
+
+    bool configureStream(yarp::os::Searchable &config, const std::string &name,
+                         const std::string &carrier, const bool reliable,
+                         StreamSettings &settings);
+    bool connectStream(const std::string &src, const std::string &dest,
+                       const StreamSettings &settings);
+    void verifyStream(const std::string &src, const std::string &dest,
+                      const StreamSettings &settings);
+    bool connectTo(const std::string &remote);
+    void disconnectFrom(const std::string &remote);
+    void disconnectInputs(yarp::os::Contactable &port);
+    void adaptStaleTimeout(const std::string &remote);
+
+    double connectTime;
+    bool reconnect();
+
+    StatePort                                 statePort;
+    yarp::os::BufferedPort<yarp::sig::Vector> feedbackPort;
+    FeedbackSender                            feedbackSender;
+    yarp::os::RpcClient                       rpcPort;
+    std::mutex                                rpcMutex;
+
+    friend AsyncReplyPort;
+    yarp::os::BufferedPort<yarp::os::Bottle>  asyncPort;
+    AsyncReplyPort                            asyncReplyPort;
+    RequestSender                             requestSender;
+    std::mutex                                asyncMutex;
+    std::map<int,PendingRequest>              pending;
+    RequestTimer                              requestTimer;
+    double asyncTimeout;
+    int nextRequestId;
+    bool asyncEnabled;
 
-    yarp::sig::Vector state;
-    yarp::os::Stamp stamp;
+    friend EventPort;
+    EventPort                                 eventPort;
+    std::mutex                                eventMutex;
+    std::condition_variable                   eventCondition;
+    std::deque<hapticdevice::ButtonEvent>     events;
+    size_t eventQueueSize;
+    int lastEventSequence;
+    unsigned long lostEvents;
+    bool eventsClosing;
+    void receive(const yarp::os::Bottle &events);
+
+    bool post(yarp::os::Bottle &cmd,
+              std::function<void(const yarp::os::Bottle*)> handler);
+    std::future<bool> postAck(yarp::os::Bottle &cmd, const bool reconfigured);
+    void complete(const int id, const yarp::os::Bottle *rep);
+    void expirePending(const double now);
+    void failPending();
+
+    StateSeqLock state;
+    std::mutex historyMutex;
+    StateHistory history;
     std::mutex mutex;
 
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+    unsigned long generation;
+    bool closing;
+
+    // the callbacks are invoked on a snapshot, outside the lock
+    std::mutex callbackMutex;
+    std::condition_variable callbackCondition;
+    std::vector<hapticdevice::HapticStateCallback*> callbacks;
+    std::vector<hapticdevice::HapticStateCallback*> dispatching;
+    std::thread::id dispatcher;
+    unsigned long dispatchRounds;
+
+    bool cacheEnabled;
+    std::atomic<int> configEpoch;
+    std::mutex cacheMutex;
+    PropertyCache cache;
+
+    void invalidateCache();
+    bool lookupCartesian(const int epoch, bool &ret);
+    bool lookupMaxFeedback(const int epoch, yarp::sig::Vector &max);
+    bool lookupTransformation(const int epoch, yarp::sig::Matrix &T);
+    bool parseAck(const yarp::os::Bottle &rep, const bool reconfigured);
+    bool parseCartesian(const yarp::os::Bottle &rep, const int epoch, bool &ret);
+    bool parseMaxFeedback(const yarp::os::Bottle &rep, const int epoch,
+                          yarp::sig::Vector &max);
+    bool parseTransformation(const yarp::os::Bottle &rep, const int epoch,
+                             yarp::sig::Matrix &T);
+
+    double predictionHorizon;
+    StatePredictor predictor;
+    double arrival;
+    ClockSync clockSync;
+
+    bool rpc(yarp::os::Bottle &cmd, yarp::os::Bottle &rep);
+    bool predict(double *xp);
+    double predictionSpan();
+
 public:
     HapticDeviceClient();
     ~HapticDeviceClient() { }
@@ -83,6 +526,49 @@ public:
 
     // IPreciselyTimed Interface
     yarp::os::Stamp getLastInputStamp();
+
+    // IHapticDeviceClient Interface
+    bool getPredictedPosition(yarp::sig::Vector &pos);
+    bool getPredictedOrientation(yarp::sig::Vector &rpy);
+    bool getPredictionAge(double &age);
+    bool getClockOffset(double &offset, double &drift);
+    bool toLocalTime(const double remote, double &local);
+    bool getSampleAge(double &age);
+    bool getState(hapticdevice::HapticState &state);
+    bool getStateAt(const double t, hapticdevice::HapticState &state);
+    bool waitForNextState(hapticdevice::HapticState &state,
+                          const double timeout = 0.0);
+    bool registerStateCallback(hapticdevice::HapticStateCallback *callback);
+    bool unregisterStateCallback(hapticdevice::HapticStateCallback *callback);
+    bool waitForButtonEvent(hapticdevice::ButtonEvent &event,
+                            const double timeout = 0.0);
+    std::future<std::optional<bool>> isCartesianForceModeEnabledAsync();
+    std::future<bool> setCartesianForceModeAsync();
+    std::future<bool> setJointTorqueModeAsync();
+    std::future<std::optional<yarp::sig::Vector>> getMaxFeedbackAsync();
+    std::future<bool> stopFeedbackAsync();
+    std::future<std::optional<yarp::sig::Matrix>> getTransformationAsync();
+    std::future<bool> setTransformationAsync(const yarp::sig::Matrix &T);
+    bool isStateStale(bool &stale);
+    bool getActiveRemote(std::string &remote);
+    bool getRecoveryTime(double &last, double &worst);
+
+    // IHapticRenderer Interface
+    bool setMesh(const std::vector<double> &vertices,
+                 const std::vector<int> &triangles);
+    bool clearMesh();
+    bool setContactParameters(const double stiffness, const double damping);
+    bool getContact(bool &contact, yarp::sig::Vector &proxy,
+                    yarp::sig::Vector &force);
+    bool getRenderStats(double &worst, int &exhausted);
+
+    // IHapticPassivity Interface
+    bool getPassivity(double &energy, double &damping,
+                      double &dissipated, int &active);
+
+    // IHapticButtonEvents Interface
+    bool getButtonEvent(hapticdevice::ButtonEvent &event);
+    bool getLostButtonEvents(unsigned long &lost);
 };
 
 #endif
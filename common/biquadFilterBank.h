@@ -0,0 +1,212 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_BIQUADFILTERBANK__
+#define __HAPTICDEVICE_BIQUADFILTERBANK__
+
+#include <cmath>
+#include <algorithm>
+
+namespace hapticdevice {
+
+/**
+ * Bank of cascaded biquad filters running over three axes at once,
+ * followed by deadzone, saturation and scaling; it conditions the
+ * forces fed back to the operator as well as the state served by
+ * the tiers of the wrapper. The axes are stored side by side and
+ * padded to a vector-friendly width, so that each stage runs over
+ * all of them in one tight loop.
+ */
+class BiquadFilterBank
+{
+public:
+    static const int axes=3;
+    static const int maxStages=8;
+
+    /**
+     * Coefficients of a biquad normalized with respect to a0.
+     */
+    struct Biquad
+    {
+        double b0,b1,b2;
+        double a1,a2;
+    };
+
+    /**
+     * Design a second-order low-pass filter.
+     * @param fc the cut-off frequency in Hz.
+     * @param fs the sampling frequency in Hz.
+     * @param q the quality factor (Butterworth by default).
+     * @return the filter coefficients.
+     */
+    static Biquad lowPass(const double fc, const double fs,
+                          const double q = M_SQRT1_2)
+    {
+        double w0=2.0*M_PI*fc/fs;
+        double c=cos(w0),alpha=sin(w0)/(2.0*q);
+        double a0=1.0+alpha;
+        return {0.5*(1.0-c)/a0,(1.0-c)/a0,0.5*(1.0-c)/a0,
+                -2.0*c/a0,(1.0-alpha)/a0};
+    }
+
+    /**
+     * Design a notch filter.
+     * @param f0 the frequency to reject in Hz.
+     * @param fs the sampling frequency in Hz.
+     * @param q the quality factor, the higher the narrower.
+     * @return the filter coefficients.
+     */
+    static Biquad notch(const double f0, const double fs, const double q)
+    {
+        double w0=2.0*M_PI*f0/fs;
+        double c=cos(w0),alpha=sin(w0)/(2.0*q);
+        double a0=1.0+alpha;
+        return {1.0/a0,-2.0*c/a0,1.0/a0,-2.0*c/a0,(1.0-alpha)/a0};
+    }
+
+    BiquadFilterBank() : nStages(0), deadzone(0.0), saturation(0.0)
+    {
+        std::fill(gain,gain+axes,1.0);
+        reset();
+    }
+
+    /**
+     * Append a stage to the cascade.
+     * @param stage the coefficients of the stage.
+     * @return true/false on success/failure, i.e. too many stages.
+     */
+    bool addStage(const Biquad &stage)
+    {
+        if (nStages>=maxStages)
+            return false;
+
+        stages[nStages++]=stage;
+        reset();
+        return true;
+    }
+
+    /**
+     * Configure the final shaping of the filtered forces.
+     * @param deadzone the filtered components whose magnitude does
+     *                 not exceed this value are zeroed.
+     * @param saturation the magnitude at which the components are
+     *                   clipped, 0.0 to disable clipping.
+     * @param gain the per-axis scaling applied last.
+     */
+    void setShaping(const double deadzone, const double saturation,
+                    const double *gain)
+    {
+        this->deadzone=std::fabs(deadzone);
+        this->saturation=std::fabs(saturation);
+        std::copy(gain,gain+axes,this->gain);
+    }
+
+    /**
+     * Clear the memory of the filters.
+     */
+    void reset()
+    {
+        for (auto &z:z1)
+            std::fill(z,z+width,0.0);
+        for (auto &z:z2)
+            std::fill(z,z+width,0.0);
+        std::fill(filtered,filtered+width,0.0);
+    }
+
+    /**
+     * Set the memory of the filters as if the input had been held at
+     * the given sample forever, so that the output starts from it
+     * rather than ramping up from zero.
+     * @param in the components of the first sample.
+     */
+    void prime(const double *in)
+    {
+        alignas(32) double x[width];
+        for (int i=0; i<width; i++)
+            x[i]=(i<axes)?in[i]:0.0;
+
+        // steady state of transposed direct form II at DC gain
+        for (int s=0; s<nStages; s++)
+        {
+            const Biquad &c=stages[s];
+            double gain=(c.b0+c.b1+c.b2)/(1.0+c.a1+c.a2);
+            for (int i=0; i<width; i++)
+            {
+                double y=gain*x[i];
+                z1[s][i]=y-c.b0*x[i];
+                z2[s][i]=c.b2*x[i]-c.a2*y;
+                x[i]=y;
+            }
+        }
+
+        std::copy(x,x+width,filtered);
+    }
+
+    /**
+     * Feed a new sample through the cascade; to be called for every
+     * sample of the stream, at the rate the stages were designed for.
+     * @param in the raw components.
+     */
+    void push(const double *in)
+    {
+        alignas(32) double x[width];
+        for (int i=0; i<width; i++)
+            x[i]=(i<axes)?in[i]:0.0;
+
+        // transposed direct form II
+        for (int s=0; s<nStages; s++)
+        {
+            const Biquad &c=stages[s];
+            double *w1=z1[s],*w2=z2[s];
+            for (int i=0; i<width; i++)
+            {
+                double y=c.b0*x[i]+w1[i];
+                w1[i]=c.b1*x[i]-c.a1*y+w2[i];
+                w2[i]=c.b2*x[i]-c.a2*y;
+                x[i]=y;
+            }
+        }
+
+        std::copy(x,x+width,filtered);
+    }
+
+    /**
+     * Get the output out of the last pushed sample.
+     * @param out the filtered, shaped and scaled components.
+     */
+    void get(double *out) const
+    {
+        for (int i=0; i<axes; i++)
+        {
+            double f=filtered[i];
+            if (std::fabs(f)<=deadzone)
+                f=0.0;
+            else if (saturation>0.0)
+                f=std::max(-saturation,std::min(f,saturation));
+            out[i]=gain[i]*f;
+        }
+    }
+
+private:
+    static const int width=4;
+
+    Biquad stages[maxStages];
+    int nStages;
+
+    alignas(32) double z1[maxStages][width];
+    alignas(32) double z2[maxStages][width];
+    alignas(32) double filtered[width];
+
+    double deadzone,saturation;
+    double gain[axes];
+};
+
+}
+
+#endif
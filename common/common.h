@@ -22,7 +22,14 @@ namespace hapticdevice {
         is_cartesian       = yarp::os::createVocab32('i','s','f'),
         set_cartesian      = yarp::os::createVocab32('s','c','a','r'),
         set_joint          = yarp::os::createVocab32('s','j','n','t'),
-        get_max            = yarp::os::createVocab32('g','m','a','x')
+        get_max            = yarp::os::createVocab32('g','m','a','x'),
+        get_time           = yarp::os::createVocab32('g','t','i','m'),
+        get_stats          = yarp::os::createVocab32('g','s','t','a'),
+        set_mesh           = yarp::os::createVocab32('s','m','s','h'),
+        clear_mesh         = yarp::os::createVocab32('c','m','s','h'),
+        set_contact        = yarp::os::createVocab32('s','c','n','t'),
+        get_contact        = yarp::os::createVocab32('g','c','n','t'),
+        get_passivity      = yarp::os::createVocab32('g','p','a','s')
     };
 }
 
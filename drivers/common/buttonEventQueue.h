@@ -0,0 +1,99 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_BUTTONEVENTQUEUE__
+#define __HAPTICDEVICE_BUTTONEVENTQUEUE__
+
+#include <atomic>
+
+#include "IHapticButtonEvents.h"
+
+/**
+ * Detection of the edges of the buttons within the servo loop and
+ * single-producer single-consumer queue handing them over to the
+ * consumer without locks, so that the servo loop is never held up.
+ */
+class ButtonEventQueue
+{
+public:
+    static const int buttons=2;
+    static const unsigned int capacity=256;
+
+    ButtonEventQueue() : head(0), tail(0), lost(0)
+    {
+        for (auto &l:levels)
+            l=false;
+    }
+
+    /**
+     * Compare the levels with the previous ones and queue the edges;
+     * to be called by the producer only.
+     * @param levels the levels of the buttons.
+     * @param stamp the time of the sample.
+     */
+    void update(const bool *levels, const double stamp)
+    {
+        for (int i=0; i<buttons; i++)
+        {
+            if (levels[i]!=this->levels[i])
+            {
+                this->levels[i]=levels[i];
+                push({i,levels[i],stamp});
+            }
+        }
+    }
+
+    /**
+     * Pop the oldest event; to be called by the consumer only.
+     * @param event the event.
+     * @return true/false on success/failure, i.e. if empty.
+     */
+    bool pop(hapticdevice::ButtonEvent &event)
+    {
+        unsigned int t=tail.load(std::memory_order_relaxed);
+        if (t==head.load(std::memory_order_acquire))
+            return false;
+
+        event=ring[t%capacity];
+        tail.store(t+1,std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Get how many events did not fit in the queue.
+     * @return the number of lost events.
+     */
+    unsigned long getLost() const
+    {
+        return lost.load(std::memory_order_relaxed);
+    }
+
+private:
+    hapticdevice::ButtonEvent ring[capacity];
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    std::atomic<unsigned long> lost;
+    bool levels[buttons];
+
+    void push(const hapticdevice::ButtonEvent &event)
+    {
+        unsigned int h=head.load(std::memory_order_relaxed);
+        if (h-tail.load(std::memory_order_acquire)>=capacity)
+        {
+            // the newest events are given up not to race with the consumer
+            lost.fetch_add(1,std::memory_order_relaxed);
+            return;
+        }
+
+        ring[h%capacity]=event;
+        head.store(h+1,std::memory_order_release);
+    }
+};
+
+#endif
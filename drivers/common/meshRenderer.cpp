@@ -0,0 +1,734 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include <yarp/math/Math.h>
+
+#include "meshRenderer.h"
+
+#define MESH_RENDERER_SKIN          1e-4    // [m]
+#define MESH_RENDERER_ITERATIONS    3
+#define MESH_RENDERER_STACK         64
+
+using namespace std;
+using namespace yarp::sig;
+using namespace yarp::math;
+
+namespace {
+
+inline double dot(const double *a, const double *b)
+{
+    return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+}
+
+inline void cross(const double *a, const double *b, double *c)
+{
+    c[0]=a[1]*b[2]-a[2]*b[1];
+    c[1]=a[2]*b[0]-a[0]*b[2];
+    c[2]=a[0]*b[1]-a[1]*b[0];
+}
+
+inline float roundDown(const double x)
+{
+    return std::nextafter((float)x,-numeric_limits<float>::infinity());
+}
+
+inline float roundUp(const double x)
+{
+    return std::nextafter((float)x,numeric_limits<float>::infinity());
+}
+
+/**
+ * Bring the goal within the half-spaces of the constraint planes,
+ * which all pass through the proxy p, moving it the least.
+ */
+void constrain(const double *p, const double (*n)[3], const int m, double *g)
+{
+    double d[3]={g[0]-p[0],g[1]-p[1],g[2]-p[2]};
+    auto feasible=[&](const double *x) {
+        for (int i=0; i<m; i++)
+            if (dot(n[i],x)<-1e-12)
+                return false;
+        return true;
+    };
+
+    if (feasible(d))
+        return;
+
+    // slide along one plane
+    for (int i=0; i<m; i++)
+    {
+        double s=std::min(0.0,dot(n[i],d));
+        double di[3]={d[0]-s*n[i][0],d[1]-s*n[i][1],d[2]-s*n[i][2]};
+        if (feasible(di))
+        {
+            g[0]=p[0]+di[0]; g[1]=p[1]+di[1]; g[2]=p[2]+di[2];
+            return;
+        }
+    }
+
+    // slide along the crease of two planes
+    for (int i=0; i<m; i++)
+    {
+        for (int j=i+1; j<m; j++)
+        {
+            double l[3];
+            cross(n[i],n[j],l);
+            double norm=sqrt(dot(l,l));
+            if (norm<1e-9)
+                continue;
+
+            double s=dot(d,l)/(norm*norm);
+            double dij[3]={s*l[0],s*l[1],s*l[2]};
+            if (feasible(dij))
+            {
+                g[0]=p[0]+dij[0]; g[1]=p[1]+dij[1]; g[2]=p[2]+dij[2];
+                return;
+            }
+        }
+    }
+
+    // stuck in a corner
+    g[0]=p[0]; g[1]=p[1]; g[2]=p[2];
+}
+
+}
+
+
+/*********************************************************************/
+bool MeshBVH::build(const vector<double> &vertices, const vector<int> &triangles,
+                    const Matrix &T, const size_t maxTriangles, string &error)
+{
+    nodes.clear();
+    blocks.clear();
+    this->triangles=0;
+
+    if ((vertices.size()%3!=0) || (triangles.size()%3!=0) || triangles.empty())
+    {
+        error="vertices and triangles must come in non-empty triplets";
+        return false;
+    }
+
+    if (triangles.size()/3>maxTriangles)
+    {
+        error="the mesh exceeds "+to_string(maxTriangles)+" triangles";
+        return false;
+    }
+
+    int nVertices=(int)(vertices.size()/3);
+    vector<double> v(vertices.size());
+    for (int i=0; i<nVertices; i++)
+        for (int r=0; r<3; r++)
+            v[3*i+r]=T(r,0)*vertices[3*i]+T(r,1)*vertices[3*i+1]+
+                     T(r,2)*vertices[3*i+2]+T(r,3);
+
+    // keep only the valid triangles, as triplets of coordinates
+    vector<double> tri,c;
+    tri.reserve(3*triangles.size());
+    c.reserve(triangles.size());
+    for (size_t i=0; i<triangles.size(); i+=3)
+    {
+        const int *idx=&triangles[i];
+        if ((std::min({idx[0],idx[1],idx[2]})<0) ||
+            (std::max({idx[0],idx[1],idx[2]})>=nVertices))
+        {
+            error="triangle "+to_string(i/3)+" refers to missing vertices";
+            return false;
+        }
+
+        const double *a=&v[3*idx[0]],*b=&v[3*idx[1]],*d=&v[3*idx[2]];
+        double e1[3]={b[0]-a[0],b[1]-a[1],b[2]-a[2]};
+        double e2[3]={d[0]-a[0],d[1]-a[1],d[2]-a[2]};
+        double n[3];
+        cross(e1,e2,n);
+        if (dot(n,n)<1e-24)
+            continue;
+
+        for (int k=0; k<3; k++)
+        {
+            tri.insert(tri.end(),&v[3*idx[k]],&v[3*idx[k]]+3);
+            c.push_back((a[k]+b[k]+d[k])/3.0);
+        }
+    }
+
+    size_t n=c.size()/3;
+    if (n==0)
+    {
+        error="the mesh is made of degenerate triangles only";
+        return false;
+    }
+
+    vector<int> ids(n);
+    for (size_t i=0; i<n; i++)
+        ids[i]=(int)i;
+
+    nodes.reserve(2*(n/width+1));
+    blocks.reserve(n/width+1);
+    buildNode(ids,0,(int)n,tri,c);
+    this->triangles=n;
+    return true;
+}
+
+
+/*********************************************************************/
+int MeshBVH::buildNode(vector<int> &ids, const int first, const int last,
+                       const vector<double> &v, const vector<double> &c)
+{
+    int idx=(int)nodes.size();
+    nodes.push_back(Node());
+
+    Node node;
+    for (int k=0; k<3; k++)
+    {
+        node.lo[k]=numeric_limits<float>::infinity();
+        node.hi[k]=-numeric_limits<float>::infinity();
+    }
+    for (int i=first; i<last; i++)
+    {
+        for (int j=0; j<9; j++)
+        {
+            int k=j%3;
+            double x=v[9*ids[i]+j];
+            node.lo[k]=std::min(node.lo[k],roundDown(x));
+            node.hi[k]=std::max(node.hi[k],roundUp(x));
+        }
+    }
+
+    if (last-first<=width)
+    {
+        Block block{};
+        for (int l=0; l<last-first; l++)
+        {
+            const double *t=&v[9*ids[first+l]];
+            for (int k=0; k<3; k++)
+            {
+                block.v0[k][l]=t[k];
+                block.e1[k][l]=t[3+k]-t[k];
+                block.e2[k][l]=t[6+k]-t[k];
+            }
+
+            double e1[3]={block.e1[0][l],block.e1[1][l],block.e1[2][l]};
+            double e2[3]={block.e2[0][l],block.e2[1][l],block.e2[2][l]};
+            double n[3];
+            cross(e1,e2,n);
+            double norm=sqrt(dot(n,n));
+            for (int k=0; k<3; k++)
+                block.n[k][l]=n[k]/norm;
+
+            block.d00[l]=dot(e1,e1);
+            block.d01[l]=dot(e1,e2);
+            block.d11[l]=dot(e2,e2);
+            block.inv[l]=1.0/(block.d00[l]*block.d11[l]-block.d01[l]*block.d01[l]);
+            block.mask[l]=1.0;
+        }
+
+        node.next=(int)blocks.size();
+        node.count=last-first;
+        blocks.push_back(block);
+    }
+    else
+    {
+        // median split along the largest extent of the centroids
+        double lo[3],hi[3];
+        for (int k=0; k<3; k++)
+        {
+            lo[k]=numeric_limits<double>::infinity();
+            hi[k]=-numeric_limits<double>::infinity();
+        }
+        for (int i=first; i<last; i++)
+        {
+            for (int k=0; k<3; k++)
+            {
+                lo[k]=std::min(lo[k],c[3*ids[i]+k]);
+                hi[k]=std::max(hi[k],c[3*ids[i]+k]);
+            }
+        }
+
+        int axis=0;
+        for (int k=1; k<3; k++)
+            if (hi[k]-lo[k]>hi[axis]-lo[axis])
+                axis=k;
+
+        int mid=(first+last)/2;
+        std::nth_element(ids.begin()+first,ids.begin()+mid,ids.begin()+last,
+                         [&](const int a, const int b) {
+                             return c[3*a+axis]<c[3*b+axis];
+                         });
+
+        buildNode(ids,first,mid,v,c);
+        node.next=buildNode(ids,mid,last,v,c);
+        node.count=0;
+    }
+
+    nodes[idx]=node;
+    return idx;
+}
+
+
+/*********************************************************************/
+bool MeshBVH::raycast(const double *o, const double *d, const double tmax,
+                      Hit &hit, Budget &budget) const
+{
+    if (nodes.empty())
+        return false;
+
+    double inv[3];
+    for (int k=0; k<3; k++)
+        inv[k]=(fabs(d[k])>1e-12)?1.0/d[k]:((d[k]<0.0)?-1e30:1e30);
+
+    hit.t=tmax;
+    int found=-1,lane=-1;
+
+    int stack[MESH_RENDERER_STACK];
+    int top=0;
+    stack[top++]=0;
+    while (top>0)
+    {
+        if (--budget.nodes<0)
+            return false;
+
+        const Node &node=nodes[stack[--top]];
+        double tnear=0.0,tfar=hit.t;
+        for (int k=0; k<3; k++)
+        {
+            double t0=(node.lo[k]-o[k])*inv[k];
+            double t1=(node.hi[k]-o[k])*inv[k];
+            tnear=std::max(tnear,std::min(t0,t1));
+            tfar=std::min(tfar,std::max(t0,t1));
+        }
+        if (tnear>tfar)
+            continue;
+
+        if (node.count==0)
+        {
+            if (top+2>MESH_RENDERER_STACK)
+                return false;
+            stack[top++]=node.next;
+            stack[top++]=(int)(&node-&nodes[0])+1;
+            continue;
+        }
+
+        if (--budget.blocks<0)
+            return false;
+
+        // Moller-Trumbore over the lanes of the block
+        const Block &b=blocks[node.next];
+        double t[width];
+        for (int l=0; l<width; l++)
+        {
+            double p0=d[1]*b.e2[2][l]-d[2]*b.e2[1][l];
+            double p1=d[2]*b.e2[0][l]-d[0]*b.e2[2][l];
+            double p2=d[0]*b.e2[1][l]-d[1]*b.e2[0][l];
+            double det=b.e1[0][l]*p0+b.e1[1][l]*p1+b.e1[2][l]*p2;
+            double invDet=(fabs(det)>1e-18)?1.0/det:0.0;
+
+            double s0=o[0]-b.v0[0][l],s1=o[1]-b.v0[1][l],s2=o[2]-b.v0[2][l];
+            double u=(s0*p0+s1*p1+s2*p2)*invDet;
+
+            double q0=s1*b.e1[2][l]-s2*b.e1[1][l];
+            double q1=s2*b.e1[0][l]-s0*b.e1[2][l];
+            double q2=s0*b.e1[1][l]-s1*b.e1[0][l];
+            double w=(d[0]*q0+d[1]*q1+d[2]*q2)*invDet;
+            double tt=(b.e2[0][l]*q0+b.e2[1][l]*q1+b.e2[2][l]*q2)*invDet;
+
+            bool valid=(invDet!=0.0) && (b.mask[l]>0.0) && (u>=0.0) &&
+                       (w>=0.0) && (u+w<=1.0) && (tt>=0.0);
+            t[l]=valid?tt:numeric_limits<double>::infinity();
+        }
+
+        for (int l=0; l<width; l++)
+        {
+            if (t[l]<hit.t)
+            {
+                hit.t=t[l];
+                found=node.next;
+                lane=l;
+            }
+        }
+    }
+
+    if (found<0)
+        return false;
+
+    // the normal faces the origin of the ray
+    const Block &b=blocks[found];
+    double n[3]={b.n[0][lane],b.n[1][lane],b.n[2][lane]};
+    double s=(dot(n,d)>0.0)?-1.0:1.0;
+    for (int k=0; k<3; k++)
+        hit.n[k]=s*n[k];
+    return true;
+}
+
+
+/*********************************************************************/
+int MeshBVH::proximity(const double *p, const double radius, double (*n)[3],
+                       const int maxPlanes, Budget &budget) const
+{
+    if (nodes.empty())
+        return 0;
+
+    int found=0;
+    int stack[MESH_RENDERER_STACK];
+    int top=0;
+    stack[top++]=0;
+    while ((top>0) && (found<maxPlanes))
+    {
+        if (--budget.nodes<0)
+            return found;
+
+        const Node &node=nodes[stack[--top]];
+        double dist2=0.0;
+        for (int k=0; k<3; k++)
+        {
+            double e=std::max({node.lo[k]-p[k],0.0,p[k]-node.hi[k]});
+            dist2+=e*e;
+        }
+        if (dist2>radius*radius)
+            continue;
+
+        if (node.count==0)
+        {
+            if (top+2>MESH_RENDERER_STACK)
+                return found;
+            stack[top++]=node.next;
+            stack[top++]=(int)(&node-&nodes[0])+1;
+            continue;
+        }
+
+        if (--budget.blocks<0)
+            return found;
+
+        // distance from the plane and barycentric coordinates of the
+        // projection of the point, over the lanes of the block
+        const Block &b=blocks[node.next];
+        double dist[width],inside[width];
+        for (int l=0; l<width; l++)
+        {
+            double r0=p[0]-b.v0[0][l],r1=p[1]-b.v0[1][l],r2=p[2]-b.v0[2][l];
+            double h=r0*b.n[0][l]+r1*b.n[1][l]+r2*b.n[2][l];
+            double q0=r0-h*b.n[0][l],q1=r1-h*b.n[1][l],q2=r2-h*b.n[2][l];
+            double d20=q0*b.e1[0][l]+q1*b.e1[1][l]+q2*b.e1[2][l];
+            double d21=q0*b.e2[0][l]+q1*b.e2[1][l]+q2*b.e2[2][l];
+            double u=(b.d11[l]*d20-b.d01[l]*d21)*b.inv[l];
+            double w=(b.d00[l]*d21-b.d01[l]*d20)*b.inv[l];
+
+            dist[l]=h;
+            inside[l]=((b.mask[l]>0.0) && (fabs(h)<=radius) && (u>=0.0) &&
+                       (w>=0.0) && (u+w<=1.0))?1.0:0.0;
+        }
+
+        for (int l=0; (l<width) && (found<maxPlanes); l++)
+        {
+            if (inside[l]>0.0)
+            {
+                double s=(dist[l]<0.0)?-1.0:1.0;
+                for (int k=0; k<3; k++)
+                    n[found][k]=s*b.n[k][l];
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+
+/*********************************************************************/
+MeshRenderer::MeshRenderer() : current(nullptr), hazard(nullptr),
+                               T(eye(4,4)), maxTriangles(200000),
+                               generation(0), stiffness(500.0), damping(0.0),
+                               maxNodes(1024), maxBlocks(256),
+                               lastGeneration(0), nPlanes(0), contact(false),
+                               worst(0.0), exhausted(0)
+{
+    std::fill(proxy,proxy+3,0.0);
+    std::fill(proxyOut,proxyOut+3,0.0);
+    std::fill(forceOut,forceOut+3,0.0);
+}
+
+
+/*********************************************************************/
+MeshRenderer::~MeshRenderer()
+{
+    delete current.exchange(nullptr);
+}
+
+
+/*********************************************************************/
+void MeshRenderer::configure(const size_t maxTriangles, const int maxNodes,
+                             const int maxBlocks)
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    this->maxTriangles=maxTriangles;
+    this->maxNodes=std::max(1,maxNodes);
+    this->maxBlocks=std::max(1,maxBlocks);
+}
+
+
+/*********************************************************************/
+void MeshRenderer::publish()
+{
+    // to be called with configMutex held
+    Scene *scene=nullptr;
+    if (mesh!=nullptr)
+    {
+        scene=new Scene;
+        scene->mesh=mesh;
+        for (int r=0; r<3; r++)
+        {
+            for (int c=0; c<3; c++)
+                scene->R[r][c]=T(r,c);
+            scene->p[r]=T(r,3);
+        }
+        scene->generation=++generation;
+    }
+
+    // the old scene is released once the servo loop is done with it
+    Scene *old=current.exchange(scene);
+    if (old!=nullptr)
+    {
+        while (hazard.load()==old)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        delete old;
+    }
+}
+
+
+/*********************************************************************/
+bool MeshRenderer::setMesh(const vector<double> &vertices,
+                           const vector<int> &triangles, string &error)
+{
+    // the mesh stays in the frame it is given in, so that a change
+    // of frame does not require to build it again
+    auto built=std::make_shared<MeshBVH>();
+    size_t maxTriangles;
+    {
+        std::lock_guard<std::mutex> lock(configMutex);
+        maxTriangles=this->maxTriangles;
+    }
+    if (!built->build(vertices,triangles,eye(4,4),maxTriangles,error))
+        return false;
+
+    std::lock_guard<std::mutex> lock(configMutex);
+    mesh=built;
+    publish();
+    return true;
+}
+
+
+/*********************************************************************/
+void MeshRenderer::clearMesh()
+{
+    std::lock_guard<std::mutex> lock(configMutex);
+    mesh.reset();
+    publish();
+}
+
+
+/*********************************************************************/
+bool MeshRenderer::setTransformation(const Matrix &Tinv)
+{
+    if ((Tinv.rows()<4) || (Tinv.cols()<4))
+        return false;
+
+    // the positions of the device are brought into the frame of
+    // the mesh, rather than the mesh into the frame of the device
+    std::lock_guard<std::mutex> lock(configMutex);
+    T=SE3inv(Tinv.submatrix(0,3,0,3));
+    if (mesh!=nullptr)
+        publish();
+    return true;
+}
+
+
+/*********************************************************************/
+void MeshRenderer::setContactParameters(const double stiffness,
+                                        const double damping)
+{
+    this->stiffness=std::max(0.0,stiffness);
+    this->damping=std::max(0.0,damping);
+}
+
+
+/*********************************************************************/
+bool MeshRenderer::advance(const MeshBVH &mesh, const double *h)
+{
+    bool aborted=false;
+    MeshBVH::Budget budget{maxNodes.load(),maxBlocks.load()};
+    double p[3]={proxy[0],proxy[1],proxy[2]};
+    double n[3][3];
+    int m=nPlanes;
+    std::copy(&planes[0][0],&planes[0][0]+9,&n[0][0]);
+
+    // move the proxy towards the device as far as the surface allows
+    for (int it=0; it<MESH_RENDERER_ITERATIONS; it++)
+    {
+        double g[3]={h[0],h[1],h[2]};
+        constrain(p,n,m,g);
+        double d[3]={g[0]-p[0],g[1]-p[1],g[2]-p[2]};
+        double len=sqrt(dot(d,d));
+        if (len<1e-9)
+            break;
+
+        for (int k=0; k<3; k++)
+            d[k]/=len;
+
+        MeshBVH::Hit hit;
+        bool hitFound=mesh.raycast(p,d,len+MESH_RENDERER_SKIN,hit,budget);
+        if (budget.exhausted())
+        {
+            aborted=true;
+            break;
+        }
+
+        if (!hitFound)
+        {
+            std::copy(g,g+3,p);
+            break;
+        }
+
+        double s=std::max(0.0,hit.t-MESH_RENDERER_SKIN);
+        for (int k=0; k<3; k++)
+            p[k]+=s*d[k];
+        if (m>=3)
+            break;
+        std::copy(hit.n,hit.n+3,n[m++]);
+    }
+
+    // the planes the proxy rests on and the device pushes against
+    if (!aborted)
+    {
+        double candidates[8][3];
+        int found=mesh.proximity(p,2.0*MESH_RENDERER_SKIN,candidates,8,budget);
+        if (budget.exhausted())
+            aborted=true;
+        else
+        {
+            double r[3]={h[0]-p[0],h[1]-p[1],h[2]-p[2]};
+            m=0;
+            for (int i=0; (i<found) && (m<3); i++)
+            {
+                if (dot(candidates[i],r)>=0.0)
+                    continue;
+
+                bool duplicate=false;
+                for (int j=0; j<m; j++)
+                    duplicate|=(dot(candidates[i],n[j])>1.0-1e-9);
+                if (!duplicate)
+                    std::copy(candidates[i],candidates[i]+3,n[m++]);
+            }
+        }
+    }
+
+    // with the budget run out, the last consistent proxy is held
+    if (!aborted)
+    {
+        std::copy(p,p+3,proxy);
+        std::copy(&n[0][0],&n[0][0]+9,&planes[0][0]);
+        nPlanes=m;
+    }
+
+    return aborted;
+}
+
+
+/*********************************************************************/
+void MeshRenderer::render(const double *h, const double *v, double *force)
+{
+    auto t0=std::chrono::steady_clock::now();
+
+    Scene *scene;
+    do
+    {
+        scene=current.load();
+        hazard.store(scene);
+    } while (scene!=current.load());
+
+    force[0]=force[1]=force[2]=0.0;
+    bool aborted=false;
+    if (scene==nullptr)
+    {
+        std::copy(h,h+3,proxy);
+        nPlanes=0;
+        lastGeneration=0;
+    }
+    else
+    {
+        // the device in the frame of the mesh
+        const double (*R)[3]=scene->R;
+        double hm[3],vm[3];
+        for (int i=0; i<3; i++)
+        {
+            hm[i]=dot(R[i],h)+scene->p[i];
+            vm[i]=dot(R[i],v);
+        }
+
+        // a new scene is entered from where the device is
+        if (scene->generation!=lastGeneration)
+        {
+            std::copy(hm,hm+3,proxy);
+            nPlanes=0;
+            lastGeneration=scene->generation;
+        }
+        else
+            aborted=advance(*scene->mesh,hm);
+
+        // the force gets back into the frame of the device
+        double k=stiffness.load(),b=damping.load();
+        double r[3]={proxy[0]-hm[0],proxy[1]-hm[1],proxy[2]-hm[2]};
+        if (dot(r,r)>1e-18)
+        {
+            double fm[3];
+            for (int i=0; i<3; i++)
+                fm[i]=k*r[i]-b*vm[i];
+            for (int i=0; i<3; i++)
+                force[i]=R[0][i]*fm[0]+R[1][i]*fm[1]+R[2][i]*fm[2];
+        }
+    }
+
+    hazard.store(nullptr);
+
+    double dt=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    double w=worst.load(std::memory_order_relaxed);
+    while ((dt>w) && !worst.compare_exchange_weak(w,dt,std::memory_order_relaxed));
+    if (aborted)
+        exhausted.fetch_add(1,std::memory_order_relaxed);
+
+    // the snapshot of the contact is skipped while being read
+    if (telemetryMutex.try_lock())
+    {
+        contact=(force[0]!=0.0) || (force[1]!=0.0) || (force[2]!=0.0);
+        std::copy(proxy,proxy+3,proxyOut);
+        std::copy(force,force+3,forceOut);
+        telemetryMutex.unlock();
+    }
+}
+
+
+/*********************************************************************/
+void MeshRenderer::getContact(bool &contact, double *proxy, double *force)
+{
+    std::lock_guard<std::mutex> lock(telemetryMutex);
+    contact=this->contact;
+    std::copy(proxyOut,proxyOut+3,proxy);
+    std::copy(forceOut,forceOut+3,force);
+}
+
+
+/*********************************************************************/
+void MeshRenderer::getStats(double &worst, int &exhausted)
+{
+    worst=this->worst.load(std::memory_order_relaxed);
+    exhausted=this->exhausted.load(std::memory_order_relaxed);
+}
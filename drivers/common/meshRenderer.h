@@ -0,0 +1,193 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_MESHRENDERER__
+#define __HAPTICDEVICE_MESHRENDERER__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <yarp/sig/Matrix.h>
+
+/**
+ * Bounding volume hierarchy over a static triangle mesh. Nodes are
+ * laid out depth-first in a flat array, and each leaf owns a block of
+ * up to four triangles stored side by side, so that a leaf is tested
+ * in one tight loop over the lanes. Queries are charged against a
+ * budget and give up as soon as it runs out.
+ */
+class MeshBVH
+{
+public:
+    static const int width=4;
+
+    struct Budget
+    {
+        int nodes;
+        int blocks;
+        bool exhausted() const { return (nodes<0) || (blocks<0); }
+    };
+
+    struct Hit
+    {
+        double t;
+        double n[3];
+    };
+
+    /**
+     * Build the hierarchy.
+     * @param vertices the coordinates x y z of the vertices.
+     * @param triangles the triplets of indexes of the vertices.
+     * @param T the transformation applied to the vertices.
+     * @param maxTriangles the largest mesh accepted.
+     * @param error the reason of the failure.
+     * @return true/false on success/failure.
+     */
+    bool build(const std::vector<double> &vertices,
+               const std::vector<int> &triangles,
+               const yarp::sig::Matrix &T, const size_t maxTriangles,
+               std::string &error);
+
+    /**
+     * Find the closest triangle hit by a ray.
+     * @param o the origin of the ray.
+     * @param d the unit direction of the ray.
+     * @param tmax the length of the ray.
+     * @param hit the distance of the hit and the normal of the
+     *            triangle facing the origin.
+     * @param budget the budget charged by the query.
+     * @return true iff a triangle is hit.
+     */
+    bool raycast(const double *o, const double *d, const double tmax,
+                 Hit &hit, Budget &budget) const;
+
+    /**
+     * Collect the planes of the triangles lying close to a point.
+     * @param p the point.
+     * @param radius the largest distance of the triangles.
+     * @param n the normals of the planes facing the point.
+     * @param maxPlanes the capacity of n.
+     * @param budget the budget charged by the query.
+     * @return the number of planes found.
+     */
+    int proximity(const double *p, const double radius, double (*n)[3],
+                  const int maxPlanes, Budget &budget) const;
+
+    size_t size() const { return triangles; }
+
+private:
+    struct Node
+    {
+        float lo[3];
+        int next;       // leaf: index of the block; inner: index of the right child
+        float hi[3];
+        int count;      // leaf: number of triangles; inner: 0
+    };
+
+    struct alignas(32) Block
+    {
+        double v0[3][width];
+        double e1[3][width];
+        double e2[3][width];
+        double n[3][width];
+        double d00[width],d01[width],d11[width],inv[width];
+        double mask[width];
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Block> blocks;
+    size_t triangles{0};
+
+    int buildNode(std::vector<int> &ids, const int first, const int last,
+                  const std::vector<double> &v, const std::vector<double> &c);
+};
+
+
+/**
+ * God-object renderer: a proxy of the device tip is kept on the
+ * surface of the mesh while the device penetrates it, and the force
+ * pulls the device towards the proxy. It is meant to run within the
+ * servo loop, where it never blocks; the mesh can be replaced at any
+ * time by the other threads.
+ */
+class MeshRenderer
+{
+    /**
+     * What the servo loop renders against: the mesh, kept in the
+     * frame it was uploaded in, and the transformation bringing the
+     * positions of the device into that frame. A scene is never
+     * modified once published, and its generation tells the servo
+     * loop that it has moved on to a new one.
+     */
+    struct Scene
+    {
+        std::shared_ptr<const MeshBVH> mesh;
+        double R[3][3];
+        double p[3];
+        unsigned long generation;
+    };
+
+    std::atomic<Scene*> current;
+    std::atomic<Scene*> hazard;
+
+    // what makes up the next scene
+    std::mutex configMutex;
+    std::shared_ptr<const MeshBVH> mesh;
+    yarp::sig::Matrix T;
+    size_t maxTriangles;
+    unsigned long generation;
+
+    std::atomic<double> stiffness,damping;
+    std::atomic<int> maxNodes,maxBlocks;
+
+    // owned by the servo loop
+    unsigned long lastGeneration;
+    double proxy[3];
+    double planes[3][3];
+    int nPlanes;
+
+    std::mutex telemetryMutex;
+    bool contact;
+    double proxyOut[3],forceOut[3];
+    std::atomic<double> worst;
+    std::atomic<int> exhausted;
+
+    void publish();
+    bool advance(const MeshBVH &mesh, const double *h);
+
+public:
+    MeshRenderer();
+    ~MeshRenderer();
+
+    void configure(const size_t maxTriangles, const int maxNodes,
+                   const int maxBlocks);
+    bool setMesh(const std::vector<double> &vertices,
+                 const std::vector<int> &triangles, std::string &error);
+    void clearMesh();
+    bool setTransformation(const yarp::sig::Matrix &Tinv);
+    void setContactParameters(const double stiffness, const double damping);
+
+    /**
+     * Advance the proxy and compute the contact force; to be called
+     * at servo rate, with quantities expressed in the frame of the
+     * device, which the transformation maps into the one of the mesh.
+     * @param h the position of the device in m.
+     * @param v the velocity of the device in m/s.
+     * @param force the contact force in N.
+     */
+    void render(const double *h, const double *v, double *force);
+
+    void getContact(bool &contact, double *proxy, double *force);
+    void getStats(double &worst, int &exhausted);
+};
+
+#endif
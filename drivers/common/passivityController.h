@@ -0,0 +1,135 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_PASSIVITYCONTROLLER__
+#define __HAPTICDEVICE_PASSIVITYCONTROLLER__
+
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
+/**
+ * Time-domain passivity observer and controller of the port through
+ * which the remote force feedback reaches the operator. The observer
+ * integrates the energy the port absorbs out of the commanded force
+ * and of the measured velocity; as soon as the port turns active,
+ * i.e. it has given the operator more energy than it ever took, the
+ * controller injects the damping that dissipates the excess within
+ * the same cycle. To be used from the servo loop only, except for
+ * the telemetry, which can be read from any thread.
+ */
+class PassivityController
+{
+public:
+    PassivityController() : enabled(false), maxDamping(20.0),
+                            minVelocity(1e-4), maxEnergy(0.0)
+    {
+        reset();
+    }
+
+    /**
+     * Configure the controller.
+     * @param enabled when false the forces are let through untouched.
+     * @param maxDamping the largest damping injected in Ns/m.
+     * @param minVelocity the speed in m/s below which no damping is
+     *                    injected, as the velocity is mostly noise.
+     * @param maxEnergy the largest energy in J the port can store
+     *                  to be released later, 0.0 not to cap it.
+     */
+    void configure(const bool enabled, const double maxDamping,
+                   const double minVelocity, const double maxEnergy)
+    {
+        this->enabled=enabled;
+        this->maxDamping=std::fabs(maxDamping);
+        this->minVelocity=std::fabs(minVelocity);
+        this->maxEnergy=std::fabs(maxEnergy);
+        reset();
+    }
+
+    /**
+     * Clear the energy observed so far.
+     */
+    void reset()
+    {
+        observed=0.0;
+        energy=0.0;
+        damping=0.0;
+        dissipated=0.0;
+        active=0;
+    }
+
+    /**
+     * Observe the port over one cycle and make it passive.
+     * @param f the force commanded to the device in N, replaced by
+     *          the force to be applied.
+     * @param v the velocity of the device in m/s.
+     * @param dt the duration of the cycle in s.
+     */
+    void process(double *f, const double *v, const double dt)
+    {
+        if (!enabled)
+            return;
+
+        // the power flowing out of the port into the operator
+        double power=f[0]*v[0]+f[1]*v[1]+f[2]*v[2];
+        double v2=v[0]*v[0]+v[1]*v[1]+v[2]*v[2];
+        observed-=power*dt;
+
+        double alpha=0.0;
+        if ((observed<0.0) && (v2>minVelocity*minVelocity))
+        {
+            // damping that brings the energy back to zero
+            alpha=std::min(-observed/(v2*dt),maxDamping);
+            for (int i=0; i<3; i++)
+                f[i]-=alpha*v[i];
+
+            double spent=alpha*v2*dt;
+            observed+=spent;
+            dissipated=dissipated+spent;
+            active++;
+        }
+
+        if ((maxEnergy>0.0) && (observed>maxEnergy))
+            observed=maxEnergy;
+
+        energy=observed;
+        damping=alpha;
+    }
+
+    /**
+     * Get the telemetry.
+     * @param energy the energy currently stored by the port in J,
+     *               negative when the damping saturated.
+     * @param damping the damping injected during the last cycle in Ns/m.
+     * @param dissipated the energy dissipated so far in J.
+     * @param active the cycles in which the damping was injected.
+     */
+    void getStats(double &energy, double &damping, double &dissipated,
+                  int &active) const
+    {
+        energy=this->energy;
+        damping=this->damping;
+        dissipated=this->dissipated;
+        active=this->active;
+    }
+
+private:
+    bool enabled;
+    double maxDamping;
+    double minVelocity;
+    double maxEnergy;
+    double observed;
+
+    std::atomic<double> energy;
+    std::atomic<double> damping;
+    std::atomic<double> dissipated;
+    std::atomic<int> active;
+};
+
+#endif
@@ -8,6 +8,7 @@
  */
 
 #include <yarp/os/LogStream.h>
+#include <yarp/os/Time.h>
 #include <yarp/math/Math.h>
 
 #include "geomagicDriver.h"
@@ -29,7 +30,7 @@ using namespace yarp::math;
 /*********************************************************************/
 GeomagicDriver::GeomagicDriver() : configured(false), verbosity(0),
                                    name(GEOMAGIC_DRIVER_DEFAULT_NAME),
-                                   T(eye(4,4))
+                                   T(eye(4,4)), Tinv(eye(4,4))
 {
 }
 
@@ -49,6 +50,13 @@ bool GeomagicDriver::open(Searchable &config)
         if (verbosity>0)
             yInfo("*** Geomagic Driver: name: %s", name.c_str());
 
+        // the query budget bounds the time rendering takes in the servo loop
+        renderer.configure(config.check("render-max-triangles",Value(200000)).asInt32(),
+                           config.check("render-max-nodes",Value(1024)).asInt32(),
+                           config.check("render-max-blocks",Value(256)).asInt32());
+        renderer.setContactParameters(config.check("render-stiffness",Value(500.0)).asFloat64(),
+                                      config.check("render-damping",Value(0.0)).asFloat64());
+
         // Initialize the device,
         // must be done before attempting to call any hd function.
         hHD = hdInitDevice((HDstring)name.c_str());
@@ -70,6 +78,18 @@ bool GeomagicDriver::open(Searchable &config)
         // motors are at room temperature (optimal).
         hdGetDoublev(HD_NOMINAL_MAX_FORCE, &maxForceMagnitude);
 
+        // The passivity controller cannot damp beyond what
+        // the device sustains, given in N*s/mm.
+        HDdouble maxDamping;
+        hdGetDoublev(HD_NOMINAL_MAX_DAMPING, &maxDamping);
+        double passivityMaxDamping=config.check("passivity-max-damping",Value(0.0)).asFloat64();
+        if ((passivityMaxDamping<=0.0) || ((maxDamping>0.0) && (passivityMaxDamping>1000.0*maxDamping)))
+            passivityMaxDamping=1000.0*maxDamping;
+        passivity.configure(config.check("passivity",Value("off")).asString()=="on",
+                            passivityMaxDamping,
+                            config.check("passivity-min-velocity",Value(1e-4)).asFloat64(),
+                            config.check("passivity-max-energy",Value(0.0)).asFloat64());
+
         // Get the maximum workspace dimensions of the
         // device, i.e. the maximum mechanical limits of
         // the device, as (minX, minY, minZ, maxX, maxY, maxZ).
@@ -176,15 +196,15 @@ bool GeomagicDriver::getPosition(Vector &pos)
     if (!readSuccessful)
         return false;
 
-    pos.resize(4);
+    pos.resize(3);
     std::lock_guard<std::mutex> lock(hDeviceDataSensorMutex);
-    pos[0]=0.001*hDeviceData.m_devicePosition[0];
-    pos[1]=0.001*hDeviceData.m_devicePosition[1];
-    pos[2]=0.001*hDeviceData.m_devicePosition[2];
-    pos[3]=1.0;
+    HDdouble x=0.001*hDeviceData.m_devicePosition[0];
+    HDdouble y=0.001*hDeviceData.m_devicePosition[1];
+    HDdouble z=0.001*hDeviceData.m_devicePosition[2];
 
-    pos=T*pos;
-    pos.pop_back();
+    // apply the transformation in place to spare temporaries
+    for (size_t i=0; i<3; i++)
+        pos[i]=T(i,0)*x+T(i,1)*y+T(i,2)*z+T(i,3);
 
     return true;
 }
@@ -277,13 +297,10 @@ bool GeomagicDriver::setFeedback(const Vector &fdbck)
 
     std::lock_guard<std::mutex> lock(hDeviceDataForceMutex);
     if (hDeviceData.m_isForce) {
-        Vector fdbck_=fdbck;
-        fdbck_.push_back(1.0);
-        fdbck_=SE3inv(T)*fdbck_;
-
-        hDeviceData.m_forceValues[0]=sat(fdbck_[0],maxForceMagnitude);
-        hDeviceData.m_forceValues[1]=sat(fdbck_[1],maxForceMagnitude);
-        hDeviceData.m_forceValues[2]=sat(fdbck_[2],maxForceMagnitude);
+        for (size_t i=0; i<3; i++)
+            hDeviceData.m_forceValues[i]=sat(Tinv(i,0)*fdbck[0]+Tinv(i,1)*fdbck[1]+
+                                             Tinv(i,2)*fdbck[2]+Tinv(i,3),
+                                             maxForceMagnitude);
     }
     else {
         hDeviceData.m_forceValues[0]=sat(fdbck[0],MAX_JOINT_TORQUE_0);
@@ -318,10 +335,16 @@ bool GeomagicDriver::setTransformation(const Matrix &T)
     }
 
     this->T=T.submatrix(0,this->T.rows()-1,0,this->T.cols()-1);
+    Tinv=SE3inv(this->T);
     if (verbosity>0)
         yInfo("*** Geomagic Driver: transformation matrix set to %s",
               this->T.toString(5,5).c_str());
 
+    // the positions are mapped into the frame of the mesh,
+    // which is not built again
+    if (!renderer.setTransformation(Tinv))
+        yError("*** Geomagic Driver: unable to move the mesh into the new frame");
+
     return true;
 }
 
@@ -423,6 +446,12 @@ GeomagicDriver::updateDeviceCallback(void *pUserData)
     pDeviceData->m_button2State =
         (nButtons & HD_DEVICE_BUTTON_2) ? HD_TRUE : HD_FALSE;
 
+    /* Queue the presses and the releases as they happen, since the
+       levels are only seen at the pace of the readers. */
+    bool levels[2]={pDeviceData->m_button1State==HD_TRUE,
+                    pDeviceData->m_button2State==HD_TRUE};
+    pThis->buttonEvents.update(levels,Time::now());
+
     /* Get the current location of the device (HD_GET_CURRENT_POSITION)
        We declare a vector of three doubles since hdGetDoublev returns
        the information in a vector of size 3. */
@@ -434,7 +463,31 @@ GeomagicDriver::updateDeviceCallback(void *pUserData)
     hdGetDoublev(HD_CURRENT_GIMBAL_ANGLES, pDeviceData->m_gimbalAngles);
 
     if (pDeviceData->m_isForce)
-        hdSetDoublev(HD_CURRENT_FORCE, pDeviceData->m_forceValues);
+    {
+        /* Render the contacts with the mesh, if any, on top of the
+           feedback; the renderer works in m and N. */
+        HDdouble velocity[3],rate;
+        hdGetDoublev(HD_CURRENT_VELOCITY, velocity);
+        hdGetDoublev(HD_INSTANTANEOUS_UPDATE_RATE, &rate);
+
+        double h[3],v[3],fdbck[3],contact[3];
+        for (int i=0; i<3; i++)
+        {
+            h[i]=0.001*pDeviceData->m_devicePosition[i];
+            v[i]=0.001*velocity[i];
+            fdbck[i]=pDeviceData->m_forceValues[i];
+        }
+
+        /* The remote feedback may come delayed: keep its port passive,
+           whereas the local rendering does not need it. */
+        pThis->passivity.process(fdbck,v,(rate>0.0)?1.0/rate:0.001);
+        pThis->renderer.render(h,v,contact);
+
+        hduVector3Dd force;
+        for (int i=0; i<3; i++)
+            force[i]=pThis->sat(fdbck[i]+contact[i],pThis->maxForceMagnitude);
+        hdSetDoublev(HD_CURRENT_FORCE, force);
+    }
     else
         hdSetDoublev(HD_CURRENT_JOINT_TORQUE, pDeviceData->m_forceValues);
 
@@ -471,3 +524,88 @@ GeomagicDriver::updateMotorForceDataCallback(void *pUserData)
     pThis->innerDeviceData.m_forceValues[2]=pThis->hDeviceData.m_forceValues[2];
     return HD_CALLBACK_DONE;
 }
+
+
+/*********************************************************************/
+bool GeomagicDriver::setMesh(const std::vector<double> &vertices,
+                             const std::vector<int> &triangles)
+{
+    std::string error;
+    if (!renderer.setMesh(vertices,triangles,error))
+    {
+        yError("*** Geomagic Driver: mesh refused (%s)",error.c_str());
+        return false;
+    }
+
+    if (verbosity>0)
+        yInfo("*** Geomagic Driver: rendering a mesh of %zu triangles",
+              triangles.size()/3);
+    return true;
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::clearMesh()
+{
+    renderer.clearMesh();
+    return true;
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::setContactParameters(const double stiffness,
+                                          const double damping)
+{
+    renderer.setContactParameters(stiffness,damping);
+    return true;
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::getContact(bool &contact, Vector &proxy, Vector &force)
+{
+    double p[3],f[3];
+    renderer.getContact(contact,p,f);
+
+    // back into the frame of the positions
+    proxy.resize(3);
+    force.resize(3);
+    for (size_t i=0; i<3; i++)
+    {
+        proxy[i]=T(i,0)*p[0]+T(i,1)*p[1]+T(i,2)*p[2]+T(i,3);
+        force[i]=T(i,0)*f[0]+T(i,1)*f[1]+T(i,2)*f[2];
+    }
+    return true;
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::getRenderStats(double &worst, int &exhausted)
+{
+    renderer.getStats(worst,exhausted);
+    return true;
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::getPassivity(double &energy, double &damping,
+                                  double &dissipated, int &active)
+{
+    passivity.getStats(energy,damping,dissipated,active);
+    return true;
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::getButtonEvent(hapticdevice::ButtonEvent &event)
+{
+    return buttonEvents.pop(event);
+}
+
+
+/*********************************************************************/
+bool GeomagicDriver::getLostButtonEvents(unsigned long &lost)
+{
+    lost=buttonEvents.getLost();
+    return true;
+}
@@ -25,6 +25,13 @@
 #include <mutex>
 #include <thread>
 
+#include "IHapticRenderer.h"
+#include "IHapticPassivity.h"
+#include "IHapticButtonEvents.h"
+#include "meshRenderer.h"
+#include "passivityController.h"
+#include "buttonEventQueue.h"
+
 /**
  * Data retrieved from HDAPI.
  */
@@ -49,13 +56,17 @@ typedef struct
  * Geomagic driver
  */
 class GeomagicDriver : public yarp::dev::DeviceDriver,
-                       public yarp::dev::IHapticDevice
+                       public yarp::dev::IHapticDevice,
+                       public hapticdevice::IHapticRenderer,
+                       public hapticdevice::IHapticPassivity,
+                       public hapticdevice::IHapticButtonEvents
 {
 protected:
     bool configured;
     int verbosity;
     std::string name;
     yarp::sig::Matrix T;
+    yarp::sig::Matrix Tinv;
 
     // True if the close method has been called at least once
     std::atomic<bool> isDeviceClosing{false};
@@ -79,6 +90,15 @@ protected:
     int numMotors;
     HDdouble maxForceMagnitude;
 
+    // God-object rendering of the contacts with a mesh
+    MeshRenderer renderer;
+
+    // Passivity of the port of the remote feedback
+    PassivityController passivity;
+
+    // Edges of the buttons detected at servo rate
+    ButtonEventQueue buttonEvents;
+
     // Get Geomagic Touch position, gimbal and buttons state
     static HDCallbackCode HDCALLBACK updateDeviceCallback(void *);
     // Copy the last device info.
@@ -111,6 +131,23 @@ public:
     bool stopFeedback();
     bool getTransformation(yarp::sig::Matrix &T);
     bool setTransformation(const yarp::sig::Matrix &T);
+
+    // IHapticRenderer Interface
+    bool setMesh(const std::vector<double> &vertices,
+                 const std::vector<int> &triangles);
+    bool clearMesh();
+    bool setContactParameters(const double stiffness, const double damping);
+    bool getContact(bool &contact, yarp::sig::Vector &proxy,
+                    yarp::sig::Vector &force);
+    bool getRenderStats(double &worst, int &exhausted);
+
+    // IHapticPassivity Interface
+    bool getPassivity(double &energy, double &damping,
+                      double &dissipated, int &active);
+
+    // IHapticButtonEvents Interface
+    bool getButtonEvent(hapticdevice::ButtonEvent &event);
+    bool getLostButtonEvents(unsigned long &lost);
 };
 
 #endif
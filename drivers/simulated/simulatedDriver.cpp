@@ -0,0 +1,558 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <yarp/os/Bottle.h>
+#include <yarp/os/LogStream.h>
+#include <yarp/os/Time.h>
+#include <yarp/os/Value.h>
+#include <yarp/math/Math.h>
+
+#include "simulatedDriver.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#define SIMULATED_DRIVER_MAX_RATE       10000.0 // [Hz]
+#define SIMULATED_DRIVER_MIN_RATE       100.0   // [Hz]
+#define SIMULATED_DRIVER_MAX_CATCHUP    10      // [steps]
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::sig;
+using namespace yarp::math;
+
+
+
+/*********************************************************************/
+SimulatedDriver::SimulatedDriver() : configured(false), verbosity(0),
+                                     rate(1000.0), mass(0.1), stiffness(200.0),
+                                     damping(5.0), workspace(0.2), maxForce(3.3),
+                                     maxTorque(350.0), profile("still"),
+                                     amplitude(0.05), frequency(0.5),
+                                     gimbalAmplitude(0.0), buttonPeriod(0.0),
+                                     T(eye(4,4)), Tinv(eye(4,4)), steps(0),
+                                     isForce(true)
+{
+    memset(&innerData,0,sizeof(innerData));
+    memset(&data,0,sizeof(data));
+    memset(force,0,sizeof(force));
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::open(Searchable &config)
+{
+    if (configured)
+    {
+        yError("*** Simulated Driver: device already opened!");
+        return false;
+    }
+
+    verbosity=config.check("verbosity",Value(0)).asInt32();
+    rate=config.check("rate",Value(1000.0)).asFloat64();
+    mass=config.check("mass",Value(0.1)).asFloat64();
+    stiffness=config.check("stiffness",Value(200.0)).asFloat64();
+    damping=config.check("damping",Value(5.0)).asFloat64();
+    workspace=fabs(config.check("workspace",Value(0.2)).asFloat64());
+    maxForce=fabs(config.check("max-force",Value(3.3)).asFloat64());
+    maxTorque=fabs(config.check("max-torque",Value(350.0)).asFloat64());
+    profile=config.check("profile",Value("still")).asString();
+    amplitude=config.check("amplitude",Value(0.05)).asFloat64();
+    frequency=config.check("frequency",Value(0.5)).asFloat64();
+    gimbalAmplitude=config.check("gimbal-amplitude",Value(0.0)).asFloat64();
+    buttonPeriod=config.check("button-period",Value(0.0)).asFloat64();
+
+    renderer.configure(config.check("render-max-triangles",Value(200000)).asInt32(),
+                       config.check("render-max-nodes",Value(1024)).asInt32(),
+                       config.check("render-max-blocks",Value(256)).asInt32());
+    renderer.setContactParameters(config.check("render-stiffness",Value(500.0)).asFloat64(),
+                                  config.check("render-damping",Value(0.0)).asFloat64());
+    passivity.configure(config.check("passivity",Value("off")).asString()=="on",
+                        config.check("passivity-max-damping",Value(20.0)).asFloat64(),
+                        config.check("passivity-min-velocity",Value(1e-4)).asFloat64(),
+                        config.check("passivity-max-energy",Value(0.0)).asFloat64());
+
+    if ((rate<SIMULATED_DRIVER_MIN_RATE) || (rate>SIMULATED_DRIVER_MAX_RATE))
+    {
+        yError("*** Simulated Driver: rate must lie in [%g, %g] Hz",
+               SIMULATED_DRIVER_MIN_RATE,SIMULATED_DRIVER_MAX_RATE);
+        return false;
+    }
+
+    if ((mass<=0.0) || (stiffness<0.0) || (damping<0.0))
+    {
+        yError("*** Simulated Driver: mass must be positive, stiffness and damping non-negative");
+        return false;
+    }
+
+    // the explicit integration needs the natural frequency well resolved
+    if (sqrt(stiffness/mass)/rate>=1.0)
+    {
+        yError("*** Simulated Driver: stiffness too high for the mass at %g Hz",rate);
+        return false;
+    }
+
+    waypoints.clear();
+    if (profile=="waypoints")
+    {
+        // ((t x y z) ...) with increasing times, looped over
+        if (Bottle *list=config.find("waypoints").asList())
+        {
+            for (size_t i=0; i<list->size(); i++)
+            {
+                Bottle *wp=list->get(i).asList();
+                if ((wp==NULL) || (wp->size()<4))
+                    continue;
+
+                vector<double> w(4);
+                for (size_t j=0; j<4; j++)
+                    w[j]=wp->get(j).asFloat64();
+                if (waypoints.empty() || (w[0]>waypoints.back()[0]))
+                    waypoints.push_back(w);
+            }
+        }
+
+        if (waypoints.size()<2)
+        {
+            yError("*** Simulated Driver: the waypoints profile requires at least two waypoints");
+            return false;
+        }
+    }
+    else if ((profile!="still") && (profile!="sine") &&
+             (profile!="circle") && (profile!="step"))
+    {
+        yError("*** Simulated Driver: unknown profile \"%s\"",profile.c_str());
+        return false;
+    }
+
+    if (verbosity>0)
+        yInfo("*** Simulated Driver: opened with profile \"%s\" at %g Hz; "
+              "mass=%g kg, stiffness=%g N/m, damping=%g Ns/m",
+              profile.c_str(),rate,mass,stiffness,damping);
+
+    memset(&innerData,0,sizeof(innerData));
+    operatorHand(0.0,innerData.position);
+    memset(force,0,sizeof(force));
+    isForce=true;
+    steps=0;
+
+    configured=true;
+    isDeviceClosing=false;
+
+    // make the state available straightaway
+    data=innerData;
+    simulationThread=std::thread(&SimulatedDriver::simulationLoop,this);
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::close()
+{
+    if (configured)
+    {
+        configured=false;
+
+        isDeviceClosing=true;
+        if (simulationThread.joinable())
+            simulationThread.join();
+
+        if (verbosity>0)
+            yInfo("*** Simulated Driver: closed after %lu steps",steps);
+        return true;
+    }
+    else
+    {
+        yError("*** Simulated Driver: trying to close a device which was not opened!");
+        return false;
+    }
+}
+
+
+/*********************************************************************/
+void SimulatedDriver::operatorHand(const double t, double *hand) const
+{
+    double w=2.0*M_PI*frequency;
+    hand[0]=hand[1]=hand[2]=0.0;
+
+    if (profile=="sine")
+    {
+        hand[0]=amplitude*sin(w*t);
+        hand[1]=0.5*amplitude*sin(2.0*w*t);
+        hand[2]=0.5*amplitude*cos(w*t);
+    }
+    else if (profile=="circle")
+    {
+        hand[0]=amplitude*cos(w*t);
+        hand[1]=amplitude*sin(w*t);
+    }
+    else if (profile=="step")
+    {
+        hand[0]=(fmod(t*frequency,1.0)<0.5)?amplitude:-amplitude;
+    }
+    else if (profile=="waypoints")
+    {
+        double span=waypoints.back()[0]-waypoints.front()[0];
+        double tau=waypoints.front()[0]+fmod(t,span);
+
+        size_t i=1;
+        while ((i<waypoints.size()-1) && (waypoints[i][0]<tau))
+            i++;
+
+        const vector<double> &a=waypoints[i-1];
+        const vector<double> &b=waypoints[i];
+        double s=std::max(0.0,std::min(1.0,(tau-a[0])/(b[0]-a[0])));
+        for (size_t j=0; j<3; j++)
+            hand[j]=a[j+1]+s*(b[j+1]-a[j+1]);
+    }
+}
+
+
+/*********************************************************************/
+void SimulatedDriver::step(const double t, const double dt)
+{
+    double hand[3],f[3];
+    bool cartesian;
+    operatorHand(t,hand);
+    {
+        std::lock_guard<std::mutex> lock(forceMutex);
+        std::copy(force,force+3,f);
+        cartesian=isForce;
+    }
+
+    // the contacts with the mesh add up to the feedback,
+    // whose port is kept passive against the delays
+    double contact[3];
+    renderer.render(innerData.position,innerData.velocity,contact);
+    if (cartesian)
+    {
+        passivity.process(f,innerData.velocity,dt);
+        for (int i=0; i<3; i++)
+            f[i]=std::max(-maxForce,std::min(f[i]+contact[i],maxForce));
+    }
+
+    // semi-implicit Euler: velocity first, then position
+    for (int i=0; i<3; i++)
+    {
+        double &x=innerData.position[i];
+        double &v=innerData.velocity[i];
+        double a=(stiffness*(hand[i]-x)-damping*v+f[i])/mass;
+        v+=a*dt;
+        x+=v*dt;
+
+        // mechanical end stops
+        if (fabs(x)>workspace)
+        {
+            x=(x>0.0)?workspace:-workspace;
+            v=0.0;
+        }
+    }
+
+    double w=2.0*M_PI*frequency;
+    innerData.gimbal[0]=gimbalAmplitude*sin(w*t);
+    innerData.gimbal[1]=-gimbalAmplitude*cos(w*t);
+    innerData.gimbal[2]=0.5*gimbalAmplitude*sin(2.0*w*t);
+
+    innerData.button1=(buttonPeriod>0.0) && (fmod(t,buttonPeriod)<0.5*buttonPeriod);
+    innerData.button2=false;
+
+    bool levels[2]={innerData.button1,innerData.button2};
+    buttonEvents.update(levels,Time::now());
+
+    std::lock_guard<std::mutex> lock(dataMutex);
+    data=innerData;
+}
+
+
+/*********************************************************************/
+void SimulatedDriver::simulationLoop()
+{
+    typedef chrono::steady_clock Clock;
+    const double dt=1.0/rate;
+    const auto period=chrono::duration_cast<Clock::duration>(chrono::duration<double>(dt));
+
+    auto t0=Clock::now();
+    auto next=t0+period;
+    double t=0.0;
+    while (!isDeviceClosing)
+    {
+        this_thread::sleep_until(next);
+
+        // integrate every period elapsed so as to keep the simulated time
+        // in step with the wall clock, giving up on a backlog too large
+        int n=0;
+        while ((Clock::now()>=next) && (n<SIMULATED_DRIVER_MAX_CATCHUP))
+        {
+            step(t,dt);
+            t+=dt;
+            steps++;
+            n++;
+            next+=period;
+        }
+
+        if (Clock::now()>=next)
+            next=Clock::now()+period;
+    }
+
+    if (verbosity>0)
+    {
+        double elapsed=chrono::duration<double>(Clock::now()-t0).count();
+        yInfo("*** Simulated Driver: achieved rate %.1f Hz",
+              (elapsed>0.0)?steps/elapsed:0.0);
+    }
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getPosition(Vector &pos)
+{
+    pos.resize(3);
+    std::lock_guard<std::mutex> lock(dataMutex);
+    double x=data.position[0];
+    double y=data.position[1];
+    double z=data.position[2];
+
+    for (size_t i=0; i<3; i++)
+        pos[i]=T(i,0)*x+T(i,1)*y+T(i,2)*z+T(i,3);
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getOrientation(Vector &rpy)
+{
+    rpy.resize(3);
+    std::lock_guard<std::mutex> lock(dataMutex);
+    rpy[0]=data.gimbal[0];
+    rpy[1]=data.gimbal[1];
+    rpy[2]=data.gimbal[2];
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getButtons(Vector &buttons)
+{
+    buttons.resize(2);
+    std::lock_guard<std::mutex> lock(dataMutex);
+    buttons[0]=data.button1?1.0:0.0;
+    buttons[1]=data.button2?1.0:0.0;
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::isCartesianForceModeEnabled(bool &ret)
+{
+    std::lock_guard<std::mutex> lock(forceMutex);
+    ret=isForce;
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::setCartesianForceMode()
+{
+    if (verbosity>0)
+        yInfo("*** Simulated Driver: Cartesian Force mode enabled");
+    std::lock_guard<std::mutex> lock(forceMutex);
+    isForce=true;
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::setJointTorqueMode()
+{
+    if (verbosity>0)
+        yInfo("*** Simulated Driver: Joint Torque mode enabled");
+    std::lock_guard<std::mutex> lock(forceMutex);
+    isForce=false;
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getMaxFeedback(Vector &max)
+{
+    max.resize(3);
+    std::lock_guard<std::mutex> lock(forceMutex);
+    max=(isForce?maxForce:maxTorque);
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::setFeedback(const Vector &fdbck)
+{
+    if (fdbck.length()!=3)
+        return false;
+
+    // forces are rotated back into the device frame
+    double f[3];
+    {
+        std::lock_guard<std::mutex> lock(dataMutex);
+        for (size_t i=0; i<3; i++)
+            f[i]=Tinv(i,0)*fdbck[0]+Tinv(i,1)*fdbck[1]+Tinv(i,2)*fdbck[2];
+    }
+
+    std::lock_guard<std::mutex> lock(forceMutex);
+    if (isForce)
+    {
+        for (size_t i=0; i<3; i++)
+            force[i]=std::max(-maxForce,std::min(f[i],maxForce));
+    }
+    else
+    {
+        // without a kinematic chain, torques in mNm push the axes directly
+        for (size_t i=0; i<3; i++)
+            force[i]=0.001*std::max(-maxTorque,std::min(fdbck[i],maxTorque));
+    }
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::stopFeedback()
+{
+    std::lock_guard<std::mutex> lock(forceMutex);
+    force[0]=force[1]=force[2]=0.0;
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::setTransformation(const Matrix &T)
+{
+    if ((T.rows()<this->T.rows()) || (T.cols()<this->T.cols()))
+    {
+        yError("*** Simulated Driver: requested to use the unsuitable transformation matrix %s",
+               T.toString(5,5).c_str());
+        return false;
+    }
+
+    Matrix inv;
+    {
+        std::lock_guard<std::mutex> lock(dataMutex);
+        this->T=T.submatrix(0,this->T.rows()-1,0,this->T.cols()-1);
+        Tinv=inv=SE3inv(this->T);
+        if (verbosity>0)
+            yInfo("*** Simulated Driver: transformation matrix set to %s",
+                  this->T.toString(5,5).c_str());
+    }
+
+    // the positions are mapped into the frame of the mesh,
+    // which is not built again
+    if (!renderer.setTransformation(inv))
+        yError("*** Simulated Driver: unable to move the mesh into the new frame");
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getTransformation(Matrix &T)
+{
+    std::lock_guard<std::mutex> lock(dataMutex);
+    T=this->T;
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::setMesh(const vector<double> &vertices,
+                              const vector<int> &triangles)
+{
+    string error;
+    if (!renderer.setMesh(vertices,triangles,error))
+    {
+        yError("*** Simulated Driver: mesh refused (%s)",error.c_str());
+        return false;
+    }
+
+    if (verbosity>0)
+        yInfo("*** Simulated Driver: rendering a mesh of %zu triangles",
+              triangles.size()/3);
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::clearMesh()
+{
+    renderer.clearMesh();
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::setContactParameters(const double stiffness,
+                                           const double damping)
+{
+    renderer.setContactParameters(stiffness,damping);
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getContact(bool &contact, Vector &proxy, Vector &force)
+{
+    double p[3],f[3];
+    renderer.getContact(contact,p,f);
+
+    // back into the frame of the positions
+    proxy.resize(3);
+    force.resize(3);
+    std::lock_guard<std::mutex> lock(dataMutex);
+    for (size_t i=0; i<3; i++)
+    {
+        proxy[i]=T(i,0)*p[0]+T(i,1)*p[1]+T(i,2)*p[2]+T(i,3);
+        force[i]=T(i,0)*f[0]+T(i,1)*f[1]+T(i,2)*f[2];
+    }
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getRenderStats(double &worst, int &exhausted)
+{
+    renderer.getStats(worst,exhausted);
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getPassivity(double &energy, double &damping,
+                                   double &dissipated, int &active)
+{
+    passivity.getStats(energy,damping,dissipated,active);
+    return true;
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getButtonEvent(hapticdevice::ButtonEvent &event)
+{
+    return buttonEvents.pop(event);
+}
+
+
+/*********************************************************************/
+bool SimulatedDriver::getLostButtonEvents(unsigned long &lost)
+{
+    lost=buttonEvents.getLost();
+    return true;
+}
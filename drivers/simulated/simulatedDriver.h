@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __SIMULATED_DRIVER__
+#define __SIMULATED_DRIVER__
+
+#include <yarp/os/Searchable.h>
+#include <yarp/dev/DeviceDriver.h>
+#include <yarp/dev/IHapticDevice.h>
+#include <yarp/sig/Vector.h>
+#include <yarp/sig/Matrix.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IHapticRenderer.h"
+#include "IHapticPassivity.h"
+#include "IHapticButtonEvents.h"
+#include "meshRenderer.h"
+#include "passivityController.h"
+#include "buttonEventQueue.h"
+
+/**
+ * Kinematic state of the simulated stylus.
+ */
+struct SimulatedData
+{
+    double position[3];    /* Stylus tip in the device frame in m. */
+    double velocity[3];    /* Stylus tip velocity in m/s.         */
+    double gimbal[3];      /* Gimbal angles in rad.               */
+    bool button1;
+    bool button2;
+};
+
+
+/**
+ * Simulated driver: a 3-DOF stylus modeled as a mass coupled to
+ * the hand of a scripted operator through a spring-damper, which
+ * is pushed by the force feedback. The dynamics is integrated by
+ * an internal loop running at a configurable rate.
+ */
+class SimulatedDriver : public yarp::dev::DeviceDriver,
+                        public yarp::dev::IHapticDevice,
+                        public hapticdevice::IHapticRenderer,
+                        public hapticdevice::IHapticPassivity,
+                        public hapticdevice::IHapticButtonEvents
+{
+protected:
+    bool configured;
+    int verbosity;
+
+    // Physical parameters of the stylus and of the grasp
+    double rate;
+    double mass,stiffness,damping;
+    double workspace;
+    double maxForce,maxTorque;
+
+    // Operator motion profile
+    std::string profile;
+    double amplitude,frequency;
+    double gimbalAmplitude;
+    double buttonPeriod;
+    std::vector<std::vector<double>> waypoints;
+
+    yarp::sig::Matrix T;
+    yarp::sig::Matrix Tinv;
+
+    std::atomic<bool> isDeviceClosing{false};
+    std::thread simulationThread;
+    unsigned long steps;
+
+    // State as produced by the loop and as served to the getters
+    SimulatedData innerData;
+    SimulatedData data;
+    std::mutex dataMutex;
+
+    // Feedback in the device frame
+    double force[3];
+    bool isForce;
+    std::mutex forceMutex;
+
+    // Contacts with the mesh, rendered within the loop
+    MeshRenderer renderer;
+
+    // Passivity of the port of the remote feedback
+    PassivityController passivity;
+
+    // Edges of the buttons detected within the loop
+    ButtonEventQueue buttonEvents;
+
+    void operatorHand(const double t, double *hand) const;
+    void step(const double t, const double dt);
+    void simulationLoop();
+
+public:
+    SimulatedDriver();
+
+    // Device Driver
+    bool open(yarp::os::Searchable &config);
+    bool close();
+
+    // IHapticDevice Interface
+    bool getPosition(yarp::sig::Vector &pos);
+    bool getOrientation(yarp::sig::Vector &rpy);
+    bool getButtons(yarp::sig::Vector &buttons);
+    bool isCartesianForceModeEnabled(bool &ret);
+    bool setCartesianForceMode();
+    bool setJointTorqueMode();
+    bool getMaxFeedback(yarp::sig::Vector &max);
+    bool setFeedback(const yarp::sig::Vector &fdbck);
+    bool stopFeedback();
+    bool getTransformation(yarp::sig::Matrix &T);
+    bool setTransformation(const yarp::sig::Matrix &T);
+
+    // IHapticRenderer Interface
+    bool setMesh(const std::vector<double> &vertices,
+                 const std::vector<int> &triangles);
+    bool clearMesh();
+    bool setContactParameters(const double stiffness, const double damping);
+    bool getContact(bool &contact, yarp::sig::Vector &proxy,
+                    yarp::sig::Vector &force);
+    bool getRenderStats(double &worst, int &exhausted);
+
+    // IHapticPassivity Interface
+    bool getPassivity(double &energy, double &damping,
+                      double &dissipated, int &active);
+
+    // IHapticButtonEvents Interface
+    bool getButtonEvent(hapticdevice::ButtonEvent &event);
+    bool getLostButtonEvents(unsigned long &lost);
+};
+
+#endif
@@ -0,0 +1,325 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+// Closed-loop latency of the teleoperation: a scripted haptic device
+// served by the hapticdevicewrapper moves in steps, the TeleOp module
+// reads it through the hapticdeviceclient and commands mock arm and
+// hand controllers, which timestamp the commands as they are received.
+// Everything runs within one process over YARP local mode.
+
+#include <cmath>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/dev/Drivers.h>
+#include <yarp/sig/all.h>
+#include <yarp/math/Math.h>
+
+#include "teleop.h"
+#include "hapticdeviceWrapper.h"
+#include "hapticdeviceClient.h"
+
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+using namespace yarp::math;
+
+
+/**********************************************************/
+class LatencyProbe
+{
+public:
+    double t0,halfPeriod,amplitude;
+
+    std::vector<double> latencies;
+    unsigned long commands;
+    double tFirst,tLast;
+    double prev;
+    clock_t cpuFirst;
+
+    /**********************************************************/
+    LatencyProbe() : t0(0.0), halfPeriod(0.1), amplitude(0.01),
+                     commands(0), tFirst(0.0), tLast(0.0), prev(0.0),
+                     cpuFirst(0)
+    {
+        latencies.reserve(100000);
+    }
+
+    /**********************************************************/
+    double level(const double t) const
+    {
+        return ((long)((t-t0)/halfPeriod)%2)*amplitude;
+    }
+
+    /**********************************************************/
+    void onCommand(const double x)
+    {
+        double t=Time::now();
+        if (commands++==0)
+        {
+            tFirst=t;
+            cpuFirst=std::clock();
+        }
+        else if (fabs(x-prev)>0.5*amplitude)
+        {
+            // the command follows the last step of the device
+            double edge=t0+floor((t-t0)/halfPeriod)*halfPeriod;
+            latencies.push_back(t-edge);
+        }
+
+        prev=x;
+        tLast=t;
+    }
+};
+
+static LatencyProbe probe;
+
+
+/**********************************************************/
+class ScriptedHaptic : public DeviceDriver, public IHapticDevice
+{
+public:
+    bool open(Searchable &config) override       { return true; }
+    bool close() override                        { return true; }
+
+    bool getPosition(Vector &pos) override
+    {
+        pos.resize(3,0.0);
+        pos[0]=probe.level(Time::now());
+        return true;
+    }
+
+    // the first button is kept pressed to keep on reaching
+    bool getOrientation(Vector &rpy) override    { rpy.resize(3,0.0); return true; }
+    bool getButtons(Vector &buttons) override    { buttons.resize(2); buttons[0]=1.0; buttons[1]=0.0; return true; }
+    bool isCartesianForceModeEnabled(bool &ret) override { ret=true; return true; }
+    bool setCartesianForceMode() override        { return true; }
+    bool setJointTorqueMode() override           { return true; }
+    bool getMaxFeedback(Vector &max) override    { max.resize(3,1.0); return true; }
+    bool setFeedback(const Vector &fdbck) override { return true; }
+    bool stopFeedback() override                 { return true; }
+    bool getTransformation(Matrix &T) override   { T=eye(4,4); return true; }
+    bool setTransformation(const Matrix &T) override { return true; }
+};
+
+
+/**********************************************************/
+class MockCartesian : public DeviceDriver, public ICartesianControl
+{
+    Vector dof;
+    double trajTime{1.0};
+
+public:
+    bool open(Searchable &config) override       { dof.resize(10,1.0); return true; }
+    bool close() override                        { return true; }
+
+    bool goToPose(const Vector &xd, const Vector &od, const double t) override
+    {
+        probe.onCommand(xd[0]);
+        return true;
+    }
+
+    bool goToPosition(const Vector &xd, const double t) override
+    {
+        probe.onCommand(xd[0]);
+        return true;
+    }
+
+    bool getPose(Vector &x, Vector &o, Stamp *stamp) override
+    {
+        x.resize(3,0.0);
+        o.resize(4,0.0);
+        o[2]=1.0;
+        return true;
+    }
+
+    bool getPose(const int axis, Vector &x, Vector &o, Stamp *stamp) override { return getPose(x,o,stamp); }
+    bool setTrackingMode(const bool f) override  { return true; }
+    bool getTrackingMode(bool *f) override       { *f=false; return true; }
+    bool setReferenceMode(const bool f) override { return true; }
+    bool getReferenceMode(bool *f) override      { *f=false; return true; }
+    bool setPosePriority(const std::string &p) override { return true; }
+    bool getPosePriority(std::string &p) override { p="position"; return true; }
+    bool goToPoseSync(const Vector &xd, const Vector &od, const double t) override { return goToPose(xd,od,t); }
+    bool goToPositionSync(const Vector &xd, const double t) override { return goToPosition(xd,t); }
+    bool getDesired(Vector &xdhat, Vector &odhat, Vector &qdhat) override { return false; }
+    bool askForPose(const Vector &xd, const Vector &od, Vector &xdhat, Vector &odhat, Vector &qdhat) override { return false; }
+    bool askForPose(const Vector &q0, const Vector &xd, const Vector &od, Vector &xdhat, Vector &odhat, Vector &qdhat) override { return false; }
+    bool askForPosition(const Vector &xd, Vector &xdhat, Vector &odhat, Vector &qdhat) override { return false; }
+    bool askForPosition(const Vector &q0, const Vector &xd, Vector &xdhat, Vector &odhat, Vector &qdhat) override { return false; }
+    bool getDOF(Vector &curDof) override         { curDof=dof; return true; }
+    bool setDOF(const Vector &newDof, Vector &curDof) override { dof=curDof=newDof; return true; }
+    bool getRestPos(Vector &curRestPos) override { return false; }
+    bool setRestPos(const Vector &newRestPos, Vector &curRestPos) override { return false; }
+    bool getRestWeights(Vector &curRestWeights) override { return false; }
+    bool setRestWeights(const Vector &newRestWeights, Vector &curRestWeights) override { return false; }
+    bool getLimits(const int axis, double *min, double *max) override { return false; }
+    bool setLimits(const int axis, const double min, const double max) override { return false; }
+    bool getTrajTime(double *t) override         { *t=trajTime; return true; }
+    bool setTrajTime(const double t) override    { trajTime=t; return true; }
+    bool getInTargetTol(double *tol) override    { return false; }
+    bool setInTargetTol(const double tol) override { return false; }
+    bool getJointsVelocities(Vector &qdot) override { return false; }
+    bool getTaskVelocities(Vector &xdot, Vector &odot) override { return false; }
+    bool setTaskVelocities(const Vector &xdot, const Vector &odot) override { return false; }
+    bool attachTipFrame(const Vector &x, const Vector &o) override { return false; }
+    bool getTipFrame(Vector &x, Vector &o) override { return false; }
+    bool removeTipFrame() override               { return false; }
+    bool checkMotionDone(bool *f) override       { *f=true; return true; }
+    bool waitMotionDone(const double period, const double timeout) override { return true; }
+    bool stopControl() override                  { return true; }
+    bool storeContext(int *id) override          { *id=1; return true; }
+    bool restoreContext(const int id) override   { return true; }
+    bool deleteContext(const int id) override    { return true; }
+    bool getInfo(Bottle &info) override          { info.clear(); return true; }
+    bool registerEvent(CartesianEvent &event) override { return false; }
+    bool unregisterEvent(CartesianEvent &event) override { return false; }
+    bool tweakSet(const Bottle &options) override { return false; }
+    bool tweakGet(Bottle &options) override      { return false; }
+};
+
+
+/**********************************************************/
+class MockHand : public DeviceDriver, public IControlMode2,
+                 public IPositionControl2, public IVelocityControl2
+{
+    static const int nAxes=16;
+
+public:
+    bool open(Searchable &config) override       { return true; }
+    bool close() override                        { return true; }
+
+    // IControlMode2
+    bool getControlMode(int j, int *mode) override { *mode=VOCAB_CM_POSITION; return true; }
+    bool getControlModes(int *modes) override    { return false; }
+    bool getControlModes(const int n, const int *joints, int *modes) override { return false; }
+    bool setControlMode(const int j, const int mode) override { return true; }
+    bool setControlModes(const int n, const int *joints, int *modes) override { return true; }
+    bool setControlModes(int *modes) override    { return true; }
+
+    // IPositionControl2 and IVelocityControl2
+    bool getAxes(int *ax) override               { *ax=nAxes; return true; }
+    bool positionMove(int j, double ref) override { return true; }
+    bool positionMove(const double *refs) override { return true; }
+    bool positionMove(const int n, const int *joints, const double *refs) override { return true; }
+    bool relativeMove(int j, double delta) override { return true; }
+    bool relativeMove(const double *deltas) override { return true; }
+    bool relativeMove(const int n, const int *joints, const double *deltas) override { return true; }
+    bool checkMotionDone(int j, bool *flag) override { *flag=true; return true; }
+    bool checkMotionDone(bool *flag) override    { *flag=true; return true; }
+    bool checkMotionDone(const int n, const int *joints, bool *flag) override { *flag=true; return true; }
+    bool setRefSpeed(int j, double sp) override  { return true; }
+    bool setRefSpeeds(const double *spds) override { return true; }
+    bool setRefSpeeds(const int n, const int *joints, const double *spds) override { return true; }
+    bool setRefAcceleration(int j, double acc) override { return true; }
+    bool setRefAccelerations(const double *accs) override { return true; }
+    bool setRefAccelerations(const int n, const int *joints, const double *accs) override { return true; }
+    bool getRefSpeed(int j, double *ref) override { return false; }
+    bool getRefSpeeds(double *spds) override     { return false; }
+    bool getRefSpeeds(const int n, const int *joints, double *spds) override { return false; }
+    bool getRefAcceleration(int j, double *acc) override { return false; }
+    bool getRefAccelerations(double *accs) override { return false; }
+    bool getRefAccelerations(const int n, const int *joints, double *accs) override { return false; }
+    bool stop(int j) override                    { return true; }
+    bool stop() override                         { return true; }
+    bool stop(const int n, const int *joints) override { return true; }
+    bool getTargetPosition(const int joint, double *ref) override { return false; }
+    bool getTargetPositions(double *refs) override { return false; }
+    bool getTargetPositions(const int n, const int *joints, double *refs) override { return false; }
+    bool velocityMove(int j, double sp) override { return true; }
+    bool velocityMove(const double *sp) override { return true; }
+    bool velocityMove(const int n, const int *joints, const double *spds) override { return true; }
+    bool getRefVelocity(const int joint, double *vel) override { return false; }
+    bool getRefVelocities(double *vels) override { return false; }
+    bool getRefVelocities(const int n, const int *joints, double *vels) override { return false; }
+};
+
+
+/**********************************************************/
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    size_t i=std::min(sorted.size()-1,(size_t)(p*(sorted.size()-1)+0.5));
+    return sorted[i];
+}
+
+
+/**********************************************************/
+int main(int argc,char *argv[])
+{
+    Network yarp;
+    Network::setLocalMode(true);
+
+    ResourceFinder rf;
+    rf.configure(argc,argv);
+    double duration=rf.check("duration",Value(10.0)).asFloat64();
+    double wrapperRate=rf.check("wrapper-rate",Value(1000.0)).asFloat64();
+    probe.halfPeriod=0.5*rf.check("step-period",Value(0.2)).asFloat64();
+    probe.amplitude=rf.check("step-size",Value(0.01)).asFloat64();
+
+    Drivers::factory().add(new DriverCreatorOf<ScriptedHaptic>("teleop_benchmark_haptic","","ScriptedHaptic"));
+    Drivers::factory().add(new DriverCreatorOf<MockCartesian>("teleop_benchmark_cartesian","","MockCartesian"));
+    Drivers::factory().add(new DriverCreatorOf<MockHand>("teleop_benchmark_hand","","MockHand"));
+    Drivers::factory().add(new DriverCreatorOf<HapticDeviceClient>("hapticdeviceclient","","HapticDeviceClient"));
+
+    probe.t0=Time::now();
+    PolyDriver drvHaptic;
+    Property optHaptic("(device teleop_benchmark_haptic)");
+    HapticDeviceWrapper wrapper;
+    Property optWrapper("(name teleop-benchmark-haptic)");
+    if (!drvHaptic.open(optHaptic) || !wrapper.open(optWrapper))
+    {
+        yError("Unable to set up the haptic device!");
+        return 1;
+    }
+    wrapper.setPeriod(1.0/wrapperRate);
+    wrapper.attach(&drvHaptic);
+
+    // no forces are streamed in, hence the filters are not involved
+    rf.setDefault("geomagic","teleop-benchmark-haptic");
+    rf.setDefault("cartesian-device","teleop_benchmark_cartesian");
+    rf.setDefault("hand-device","teleop_benchmark_hand");
+    rf.setDefault("status-period","0.0");
+
+    TeleOp teleop;
+    std::thread th([&]() { teleop.runModule(rf); });
+    Time::delay(duration);
+    teleop.stopModule();
+    th.join();
+
+    clock_t cpuLast=std::clock();
+    wrapper.close();
+    drvHaptic.close();
+
+    if (probe.latencies.empty())
+    {
+        yError("No steps went through the loop!");
+        return 1;
+    }
+
+    std::vector<double> sorted=probe.latencies;
+    std::sort(sorted.begin(),sorted.end());
+    double span=probe.tLast-probe.tFirst;
+    double cpu=(double)(cpuLast-probe.cpuFirst)/CLOCKS_PER_SEC;
+
+    yInfo("loop=%s; wrapper-rate=%g Hz; steps=%zu; commands=%lu",
+          rf.check("loop",Value("event")).asString().c_str(),wrapperRate,
+          sorted.size(),probe.commands);
+    yInfo("latency [ms]: p50=%.3f p90=%.3f p99=%.3f max=%.3f",
+          1e3*percentile(sorted,0.5),1e3*percentile(sorted,0.9),
+          1e3*percentile(sorted,0.99),1e3*sorted.back());
+    yInfo("command rate: %.1f Hz",(span>0.0)?(probe.commands-1)/span:0.0);
+    yInfo("CPU per cycle (whole process): %.1f us",
+          1e6*cpu/std::max(1UL,probe.commands));
+
+    return 0;
+}
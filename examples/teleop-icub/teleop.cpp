@@ -0,0 +1,765 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <mutex>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/sig/all.h>
+#include <yarp/math/Math.h>
+
+#include "teleop.h"
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+using namespace yarp::math;
+
+
+/**********************************************************/
+void StatusReporter::reset(const double t)
+{
+    tLast=t;
+    cycles=ages=0;
+    latencySum=latencyMax=0.0;
+    ageSum=ageMax=0.0;
+}
+
+
+/**********************************************************/
+StatusReporter::StatusReporter() : period(1.0)
+{
+    reset(Time::now());
+}
+
+
+/**********************************************************/
+void StatusReporter::configure(const double period)
+{
+    this->period=period;
+    reset(Time::now());
+}
+
+
+/**********************************************************/
+void StatusReporter::update(const double latency, const double age)
+{
+    cycles++;
+    latencySum+=latency;
+    latencyMax=std::max(latencyMax,latency);
+    if (age>=0.0)
+    {
+        ages++;
+        ageSum+=age;
+        ageMax=std::max(ageMax,age);
+    }
+}
+
+
+/**********************************************************/
+bool StatusReporter::isDue() const
+{
+    return ((period>0.0) && (Time::now()-tLast>=period));
+}
+
+
+/**********************************************************/
+void StatusReporter::report(const string &status)
+{
+    double t=Time::now();
+    double dt=t-tLast;
+    if (cycles>0)
+    {
+        yInfo("%s [rate=%.1f Hz; latency=%.3f/%.3f ms (mean/max)]",
+              status.c_str(),cycles/dt,1e3*latencySum/cycles,1e3*latencyMax);
+        if (ages>0)
+            yInfo("sample age=%.3f/%.3f ms (mean/max)",
+                  1e3*ageSum/ages,1e3*ageMax);
+    }
+    else
+        yInfo("%s [no samples]",status.c_str());
+
+    reset(t);
+}
+
+
+/**********************************************************/
+void SideEffects::updateSim(const Vector &x)
+{
+    Vector c(4,1.0);
+    c[0]=x[0];
+    c[1]=x[1];
+    c[2]=x[2];
+    c=Tsim*c;
+
+    Bottle cmd,reply;
+    cmd.addString("world");
+    cmd.addString("set");
+    cmd.addString("ssph");
+
+    // obj #
+    cmd.addInt(1);
+
+    // position
+    cmd.addDouble(c[0]);
+    cmd.addDouble(c[1]);
+    cmd.addDouble(c[2]);
+
+    simPort->write(cmd,reply);
+}
+
+
+/**********************************************************/
+void SideEffects::run()
+{
+    double t=Time::now();
+    Vector sim,fix;
+    bool doSim=false,doGaze=false,doStop=false;
+    {
+        lock_guard<mutex> lg(mtx);
+        if (simFresh && (t-tSim>=simPeriod))
+        {
+            sim=simTarget;
+            simFresh=false;
+            doSim=true;
+            tSim=t;
+        }
+
+        // stopping the gaze is not subject to the rate limit
+        if (gazeStop)
+        {
+            gazeStop=gazeFresh=false;
+            doStop=true;
+        }
+        else if (gazeFresh && (t-tGaze>=gazePeriod))
+        {
+            fix=gazeTarget;
+            gazeFresh=false;
+            doGaze=true;
+            tGaze=t;
+        }
+    }
+
+    if (doSim && (simPort!=NULL))
+        updateSim(sim);
+
+    if (igaze!=NULL)
+    {
+        if (doStop)
+            igaze->stopControl();
+        else if (doGaze)
+            igaze->lookAtFixationPoint(fix);
+    }
+}
+
+
+/**********************************************************/
+SideEffects::SideEffects() : PeriodicThread(0.01), simPort(NULL), igaze(NULL),
+                             simPeriod(0.0), gazePeriod(0.0), simFresh(false),
+                             gazeFresh(false), gazeStop(false), tSim(0.0), tGaze(0.0)
+{
+}
+
+
+/**********************************************************/
+void SideEffects::configure(RpcClient *simPort, IGazeControl *igaze,
+                            const Matrix &Tsim, const double simRate,
+                            const double gazeRate)
+{
+    this->simPort=simPort;
+    this->igaze=igaze;
+    this->Tsim=Tsim;
+    simPeriod=(simRate>0.0)?1.0/simRate:0.0;
+    gazePeriod=(gazeRate>0.0)?1.0/gazeRate:0.0;
+}
+
+
+/**********************************************************/
+void SideEffects::setSimTarget(const Vector &x)
+{
+    lock_guard<mutex> lg(mtx);
+    simTarget=x;
+    simFresh=true;
+}
+
+
+/**********************************************************/
+void SideEffects::lookAt(const Vector &x)
+{
+    lock_guard<mutex> lg(mtx);
+    gazeTarget=x;
+    gazeFresh=true;
+    gazeStop=false;
+}
+
+
+/**********************************************************/
+void SideEffects::stopGaze()
+{
+    lock_guard<mutex> lg(mtx);
+    gazeStop=true;
+    gazeFresh=false;
+}
+
+
+/**********************************************************/
+ForceFeedbackPort::ForceFeedbackPort() : fresh(false)
+{
+    std::fill(raw,raw+3,0.0);
+    useCallback();
+}
+
+
+/**********************************************************/
+void ForceFeedbackPort::configure(const hapticdevice::BiquadFilterBank &conditioner)
+{
+    lock_guard<mutex> lg(mtx);
+    this->conditioner=conditioner;
+    this->conditioner.reset();
+    std::fill(raw,raw+3,0.0);
+    fresh=false;
+}
+
+
+/**********************************************************/
+void ForceFeedbackPort::onRead(Bottle &force)
+{
+    lock_guard<mutex> lg(mtx);
+    size_t sz=std::min((size_t)3,(size_t)force.size());
+    for (size_t i=0; i<sz; i++)
+        raw[i]=force.get(i).asFloat64();
+    conditioner.push(raw);
+    fresh=true;
+}
+
+
+/**********************************************************/
+bool ForceFeedbackPort::getFeedback(double *out)
+{
+    lock_guard<mutex> lg(mtx);
+    conditioner.get(out);
+    bool ret=fresh;
+    fresh=false;
+    return ret;
+}
+
+
+/**********************************************************/
+bool TeleOp::configure(ResourceFinder &rf)
+{
+    string name=rf.check("name",Value("teleop-icub")).asString().c_str();
+    string robot=rf.check("robot",Value("icub")).asString().c_str();
+    string geomagic=rf.check("geomagic",Value("geomagic")).asString().c_str();
+    double Tp2p=rf.check("Tp2p",Value(1.0)).asFloat64();
+    part=rf.check("part",Value("right_arm")).asString().c_str();
+    simulator=rf.check("simulator",Value("off")).asString()=="on";
+    gaze=rf.check("gaze",Value("off")).asString()=="on";
+    minForce=fabs(rf.check("min-force-feedback",Value(3.0)).asFloat64());
+    maxForce=fabs(rf.check("max-force-feedback",Value(15.0)).asFloat64());
+    bool torso=rf.check("torso",Value("on")).asString()=="on";
+    double simRate=rf.check("simulator-rate",Value(20.0)).asFloat64();
+    double gazeRate=rf.check("gaze-rate",Value(20.0)).asFloat64();
+    double forceRate=rf.check("force-rate",Value(100.0)).asFloat64();
+    double forceLowPass=rf.check("force-low-pass",Value(0.0)).asFloat64();
+    double forceNotch=rf.check("force-notch",Value(0.0)).asFloat64();
+    double forceNotchQ=rf.check("force-notch-q",Value(5.0)).asFloat64();
+    string loop=rf.check("loop",Value("event")).asString();
+    string cartDevice=rf.check("cartesian-device",Value("cartesiancontrollerclient")).asString();
+    string handDevice=rf.check("hand-device",Value("remote_controlboard")).asString();
+    reporter.configure(rf.check("status-period",Value(1.0)).asFloat64());
+
+    Property optGeo("(device hapticdeviceclient)");
+    optGeo.put("remote",("/"+geomagic).c_str());
+    optGeo.put("local",("/"+name+"/geomagic").c_str());
+    if (!drvGeomagic.open(optGeo))
+        return false;
+    drvGeomagic.view(igeo);
+
+    // the control loop is paced by the haptic samples if possible
+    eventDriven=(loop=="event");
+    if (!drvGeomagic.view(ievents))
+        ievents=NULL;
+    if (!drvGeomagic.view(iclient))
+    {
+        iclient=NULL;
+        if (eventDriven)
+        {
+            yWarning("haptic device client does not provide samples events, using timer loop");
+            eventDriven=false;
+        }
+    }
+
+    if (simulator)
+    {
+        simPort.open(("/"+name+"/simulator:rpc").c_str());
+        if (!Network::connect(simPort.getName().c_str(),"/icubSim/world"))
+        {
+            yError("iCub simulator is not running!");
+            drvGeomagic.close();
+            simPort.close();
+            return false;
+        }
+    }
+
+    if (gaze)
+    {
+        Property optGaze("(device gazecontrollerclient)");
+        optGaze.put("remote","/iKinGazeCtrl");
+        optGaze.put("local",("/"+name+"/gaze").c_str());
+        if (!drvGaze.open(optGaze))
+        {
+            drvGeomagic.close();
+            simPort.close();
+            return false;
+        }
+        drvGaze.view(igaze);
+    }
+
+    Property optCart;
+    optCart.put("device",cartDevice);
+    optCart.put("remote",("/"+robot+"/cartesianController/"+part).c_str());
+    optCart.put("local",("/"+name+"/cartesianController/"+part).c_str());
+    if (!drvCart.open(optCart))
+    {
+        drvGeomagic.close();
+        if (simulator)
+            simPort.close();
+        if (gaze)
+            drvGaze.close();
+        return false;
+    }
+    drvCart.view(iarm);
+
+    Property optHand;
+    optHand.put("device",handDevice);
+    optHand.put("remote",("/"+robot+"/"+part).c_str());
+    optHand.put("local",("/"+name+"/"+part).c_str());
+    if (!drvHand.open(optHand))
+    {
+        drvGeomagic.close();
+        if (simulator)
+            simPort.close();
+        if (gaze)
+            drvGaze.close();
+        drvCart.close();
+        return false;
+    }
+    drvHand.view(imod);
+    drvHand.view(ipos);
+    drvHand.view(ivel);
+
+    iarm->storeContext(&startup_context);
+    iarm->restoreContext(0);
+
+    Vector dof(10,1.0);
+    if (!torso)
+        dof[0]=dof[1]=dof[2]=0.0;
+    else
+        dof[1]=0.0;
+    iarm->setDOF(dof,dof);
+    iarm->setTrajTime(Tp2p);
+
+    Vector accs,poss;
+    for (int i=0; i<9; i++)
+    {
+        joints.push_back(7+i);
+        modes.push_back(VOCAB_CM_POSITION);
+        accs.push_back(1e9);
+        vels.push_back(100.0);
+        poss.push_back(0.0);
+    }
+    poss[0]=20.0;
+    poss[1]=70.0;
+
+    imod->setControlModes(joints.size(),joints.getFirst(),modes.getFirst());
+    ipos->setRefAccelerations(joints.size(),joints.getFirst(),accs.data());
+    ipos->setRefSpeeds(joints.size(),joints.getFirst(),vels.data());
+    ipos->positionMove(joints.size(),joints.getFirst(),poss.data());
+
+    joints.clear();
+    modes.clear();
+    vels.clear();
+    for (int i=2; i<9; i++)
+    {
+        joints.push_back(7+i);
+        modes.push_back(VOCAB_CM_VELOCITY);
+        vels.push_back(40.0);
+    }
+    vels[vels.length()-1]=100.0;
+
+    s0=s1=idle;
+    c0=c1=0;
+    t0=t1=0.0;
+    onlyXYZ=true;
+
+    stateStr[idle]="idle";
+    stateStr[triggered]="triggered";
+    stateStr[running]="running";
+
+    Matrix T=zeros(4,4);
+    T(0,1)=1.0;
+    T(1,2)=1.0;
+    T(2,0)=1.0;
+    T(3,3)=1.0;
+    igeo->setTransformation(SE3inv(T));
+    igeo->setCartesianForceMode();
+    igeo->getMaxFeedback(maxFeedback);
+
+    hapticdevice::BiquadFilterBank conditioner;
+    if (forceLowPass>0.0)
+        conditioner.addStage(hapticdevice::BiquadFilterBank::lowPass(forceLowPass,forceRate));
+    if (forceNotch>0.0)
+        conditioner.addStage(hapticdevice::BiquadFilterBank::notch(forceNotch,forceRate,forceNotchQ));
+
+    double gain[3];
+    for (int i=0; i<3; i++)
+        gain[i]=((i<(int)maxFeedback.length())?maxFeedback[i]:0.0)/maxForce;
+    conditioner.setShaping(minForce,maxForce,gain);
+    forceFbPort.configure(conditioner);
+
+    Tsim=zeros(4,4);
+    Tsim(0,1)=-1.0;
+    Tsim(1,2)=1.0;  Tsim(1,3)=0.5976;
+    Tsim(2,0)=-1.0; Tsim(2,3)=-0.026;
+    Tsim(3,3)=1.0;
+
+    pos0.resize(3,0.0);
+    rpy0.resize(3,0.0);
+
+    x0.resize(3,0.0);
+    o0.resize(4,0.0);
+    xd.resize(3,0.0);
+    od.resize(4,0.0);
+
+    if (simulator)
+    {
+        Bottle cmd,reply;
+        cmd.addString("world");
+        cmd.addString("mk");
+        cmd.addString("ssph");
+
+        // radius
+        cmd.addDouble(0.02);
+
+        // position
+        cmd.addDouble(0.0);
+        cmd.addDouble(0.0);
+        cmd.addDouble(0.0);
+
+        // color
+        cmd.addInt(1);
+        cmd.addInt(0);
+        cmd.addInt(0);
+
+        // collision
+        cmd.addString("FALSE");
+
+        simPort.write(cmd,reply);
+    }
+
+    // the samples are filtered by the callback of the port as they
+    // arrive, so that nothing queues up behind the control loop
+    forceFbPort.open(("/"+name+"/force-feedback:i").c_str());
+    feedback.resize(3,0.0);
+
+    // simulator and gaze are updated off the control loop
+    if (simulator || gaze)
+    {
+        sideEffects.configure(simulator?&simPort:NULL,gaze?igaze:NULL,
+                              Tsim,simRate,gazeRate);
+        sideEffects.start();
+    }
+
+    return true;
+}
+
+
+/**********************************************************/
+bool TeleOp::close()
+{
+    if (sideEffects.isRunning())
+        sideEffects.stop();
+
+    iarm->stopControl();
+    iarm->restoreContext(startup_context);
+    drvCart.close();
+
+    ivel->stop(joints.size(),joints.getFirst());
+    for (size_t i=0; i<modes.size(); i++)
+        modes[i]=VOCAB_CM_POSITION;
+    imod->setControlModes(joints.size(),joints.getFirst(),modes.getFirst());
+    drvHand.close();
+
+    if (simulator)
+    {
+        Bottle cmd,reply;
+        cmd.addString("world");
+        cmd.addString("del");
+        cmd.addString("all");
+        simPort.write(cmd,reply);
+
+        simPort.close();
+    }
+
+    if (gaze)
+    {
+        igaze->stopControl();
+        drvGaze.close();
+    }
+
+    igeo->stopFeedback();
+    igeo->setTransformation(eye(4,4));
+    drvGeomagic.close();
+    forceFbPort.close();
+
+    return true;
+}
+
+
+/**********************************************************/
+void TeleOp::reachingHandler(const bool b, const Vector &pos,
+                             const Vector &rpy)
+{
+    if (b)
+    {
+        if (s0==idle)
+        {
+            s0=triggered;
+            t0=Time::now();
+        }
+        else if (s0==triggered)
+        {
+            c0++;
+            if (Time::now()-t0>0.5)
+            {
+                pos0[0]=pos[0];
+                pos0[1]=pos[1];
+                pos0[2]=pos[2];
+
+                rpy0[0]=rpy[0];
+                rpy0[1]=rpy[1];
+                rpy0[2]=rpy[2];
+
+                iarm->getPose(x0,o0);
+                s0=running;
+            }
+        }
+        else
+        {
+            xd.resize(4);
+            xd[0]=pos[0]-pos0[0];
+            xd[1]=pos[1]-pos0[1];
+            xd[2]=pos[2]-pos0[2];
+            xd[3]=1.0;
+
+            Matrix H0=eye(4,4);
+            H0(0,3)=x0[0];
+            H0(1,3)=x0[1];
+            H0(2,3)=x0[2];
+
+            xd=H0*xd;
+
+            Matrix Rd;
+            if (onlyXYZ)
+                Rd=axis2dcm(o0);
+            else
+            {
+                Vector drpy(3);
+                drpy[0]=rpy[0]-rpy0[0];
+                drpy[1]=rpy[1]-rpy0[1];
+                drpy[2]=rpy[2]-rpy0[2];
+
+                Vector ax(4,0.0),ay(4,0.0),az(4,0.0);
+                ax[0]=1.0; ax[3]=drpy[2];
+                ay[1]=1.0; ay[3]=drpy[1]*((part=="left_arm")?1.0:-1.0);
+                az[2]=1.0; az[3]=drpy[0]*((part=="left_arm")?1.0:-1.0);
+
+                Rd=axis2dcm(o0)*axis2dcm(ax)*axis2dcm(ay)*axis2dcm(az);
+            }
+
+            xd.resize(3);
+            od=dcm2axis(Rd);
+            iarm->goToPose(xd,od);
+
+            if (gaze)
+                sideEffects.lookAt(xd);
+
+            if (simulator)
+                sideEffects.setSimTarget(xd);
+        }
+    }
+    else
+    {
+        if (s0==triggered)
+            onlyXYZ=!onlyXYZ;
+
+        if (c0!=0)
+        {
+            iarm->stopControl();
+            if (simulator)
+            {
+                Vector x,o;
+                iarm->getPose(x,o);
+                sideEffects.setSimTarget(x);
+            }
+            if (gaze)
+                sideEffects.stopGaze();
+        }
+
+        s0=idle;
+        c0=0;
+    }
+}
+
+
+/**********************************************************/
+void TeleOp::handHandler(const bool b)
+{
+    if (b)
+    {
+        if (s1==idle)
+        {
+            s1=triggered;
+            t1=Time::now();
+        }
+        else if (s1==triggered)
+        {
+            c1++;
+            if (Time::now()-t1>0.5)
+            {
+                imod->setControlModes(joints.size(),joints.getFirst(),modes.getFirst());
+                s1=running;
+            }
+        }
+        else
+            ivel->velocityMove(joints.size(),joints.getFirst(),vels.data());
+    }
+    else
+    {
+        if (s1==triggered)
+            vels=-1.0*vels;
+
+        if (c1!=0)
+            ivel->stop(joints.size(),joints.getFirst());
+
+        s1=idle;
+        c1=0;
+    }
+}
+
+
+/**********************************************************/
+double TeleOp::getPeriod()
+{
+    // in event mode, updateModule() blocks until the next sample
+    return (eventDriven?0.0:0.01);
+}
+
+
+/**********************************************************/
+string TeleOp::status()
+{
+    ostringstream str;
+    str<<"[reaching="<<stateStr[s0]<<"; pose="<<(onlyXYZ?"xyz":"full")<<";] "
+       <<"[hand="<<stateStr[s1]<<"; movement="<<(vels[0]>0.0?"closing":"opening")<<";]";
+    if (s0==running)
+        str<<" going to ("<<xd.toString(3,3)<<") ("<<od.toString(3,3)<<")";
+    if (norm(feedback)>0.0)
+        str<<" feedback=("<<feedback.toString(3,3)<<")";
+    return str.str();
+}
+
+
+/**********************************************************/
+bool TeleOp::updateModule()
+{
+    Vector buttons(2),pos(3),rpy(3);
+    double age=-1.0;
+    double tick;
+    if (eventDriven)
+    {
+        // wake up as soon as a new sample arrives, yet not
+        // indefinitely, so that the module can be stopped
+        if (!iclient->waitForNextState(state,0.1))
+        {
+            if (reporter.isDue())
+                reporter.report(status());
+            return true;
+        }
+
+        tick=Time::now();
+        std::copy(state.buttons,state.buttons+2,buttons.begin());
+        std::copy(state.position,state.position+3,pos.begin());
+        std::copy(state.orientation,state.orientation+3,rpy.begin());
+
+        double t;
+        if (iclient->toLocalTime(state.stamp,t))
+            age=tick-t;
+    }
+    else
+    {
+        tick=Time::now();
+        igeo->getButtons(buttons);
+        igeo->getPosition(pos);
+        igeo->getOrientation(rpy);
+        if (iclient!=NULL)
+            iclient->getSampleAge(age);
+    }
+
+    bool b0=(buttons[0]!=0.0);
+    bool b1=(buttons[1]!=0.0);
+
+    // clicks shorter than a cycle leave no trace in the levels,
+    // yet they come through the events: they get played back as
+    // a press followed by the release seen now
+    bool clicked[2]={false,false};
+    hapticdevice::ButtonEvent event;
+    while ((ievents!=NULL) && ievents->getButtonEvent(event))
+        if (event.pressed && (event.button>=0) && (event.button<2))
+            clicked[event.button]=true;
+
+    if (clicked[0] && !b0 && (s0==idle))
+        reachingHandler(true,pos,rpy);
+    if (clicked[1] && !b1 && (s1==idle))
+        handHandler(true);
+
+    reachingHandler(b0,pos,rpy);
+    handHandler(b1);
+
+    // the filters run over every received sample, even while
+    // no feedback is given, so as to be ready when it is needed;
+    // here only the latest conditioned force is picked up
+    double force[3];
+    bool fresh=forceFbPort.getFeedback(force);
+
+    if (!b0 && !b1)
+    {
+        if (norm(feedback)>0.0)
+        {
+            igeo->stopFeedback();
+            feedback=0.0;
+        }
+    }
+    else if (fresh)
+    {
+        std::copy(force,force+3,feedback.begin());
+        igeo->setFeedback(feedback);
+    }
+
+    reporter.update(Time::now()-tick,age);
+    if (reporter.isDue())
+        reporter.report(status());
+
+    return true;
+}
@@ -0,0 +1,159 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __TELEOP_ICUB__
+#define __TELEOP_ICUB__
+
+#include <string>
+#include <map>
+#include <mutex>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/sig/all.h>
+
+#include "IHapticDeviceClient.h"
+#include "biquadFilterBank.h"
+
+
+/**********************************************************/
+class StatusReporter
+{
+    double period;
+    double tLast;
+    int cycles;
+    double latencySum,latencyMax;
+    double ageSum,ageMax;
+    int ages;
+
+    void reset(const double t);
+
+public:
+    StatusReporter();
+    void configure(const double period);
+    void update(const double latency, const double age);
+    bool isDue() const;
+    void report(const std::string &status);
+};
+
+
+/**********************************************************/
+class SideEffects : public yarp::os::PeriodicThread
+{
+    yarp::os::RpcClient *simPort;
+    yarp::dev::IGazeControl *igaze;
+    yarp::sig::Matrix Tsim;
+    double simPeriod,gazePeriod;
+
+    // latest-wins mailboxes
+    std::mutex mtx;
+    yarp::sig::Vector simTarget,gazeTarget;
+    bool simFresh,gazeFresh,gazeStop;
+    double tSim,tGaze;
+
+    void updateSim(const yarp::sig::Vector &x);
+    void run() override;
+
+public:
+    SideEffects();
+    void configure(yarp::os::RpcClient *simPort, yarp::dev::IGazeControl *igaze,
+                   const yarp::sig::Matrix &Tsim, const double simRate,
+                   const double gazeRate);
+    void setSimTarget(const yarp::sig::Vector &x);
+    void lookAt(const yarp::sig::Vector &x);
+    void stopGaze();
+};
+
+
+/**********************************************************/
+class ForceFeedbackPort : public yarp::os::BufferedPort<yarp::os::Bottle>
+{
+    // the filters see every sample as it arrives, while the
+    // control loop only picks up the latest conditioned force
+    std::mutex mtx;
+    hapticdevice::BiquadFilterBank conditioner;
+    double raw[3];
+    bool fresh;
+
+    void onRead(yarp::os::Bottle &force) override;
+
+public:
+    ForceFeedbackPort();
+    void configure(const hapticdevice::BiquadFilterBank &conditioner);
+    bool getFeedback(double *out);
+};
+
+
+/**********************************************************/
+class TeleOp: public yarp::os::RFModule
+{
+protected:
+    yarp::dev::PolyDriver         drvCart;
+    yarp::dev::PolyDriver         drvHand;
+    yarp::dev::PolyDriver         drvGaze;
+    yarp::dev::PolyDriver         drvGeomagic;
+    yarp::dev::ICartesianControl *iarm;
+    yarp::dev::IControlMode2     *imod;
+    yarp::dev::IPositionControl2 *ipos;
+    yarp::dev::IVelocityControl2 *ivel;
+    yarp::dev::IGazeControl      *igaze;
+    yarp::dev::IHapticDevice     *igeo;
+
+    hapticdevice::IHapticDeviceClient *iclient;
+    hapticdevice::IHapticButtonEvents *ievents;
+    hapticdevice::HapticState state;
+    bool eventDriven;
+    StatusReporter reporter;
+
+    ForceFeedbackPort forceFbPort;
+    yarp::os::RpcClient simPort;
+
+    std::string part;
+    int startup_context;
+
+    enum {
+        idle,
+        triggered,
+        running
+    };
+
+    int s0,s1;
+    int c0,c1;
+    double t0,t1;
+    bool simulator;
+    bool gaze;
+    bool onlyXYZ;
+    std::map<int,std::string> stateStr;
+
+    yarp::sig::Matrix Tsim;
+    SideEffects sideEffects;
+    yarp::sig::Vector pos0,rpy0;
+    yarp::sig::Vector x0,o0;
+    yarp::sig::Vector xd,od;
+
+    yarp::sig::VectorOf<int> joints,modes;
+    yarp::sig::Vector vels;
+
+    yarp::sig::Vector maxFeedback;
+    yarp::sig::Vector feedback;
+    double minForce;
+    double maxForce;
+
+public:
+    bool configure(yarp::os::ResourceFinder &rf);
+    bool close();
+    void reachingHandler(const bool b, const yarp::sig::Vector &pos,
+                         const yarp::sig::Vector &rpy);
+    void handHandler(const bool b);
+    double getPeriod();
+    std::string status();
+    bool updateModule();
+};
+
+#endif
@@ -0,0 +1,56 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_IBUTTONEVENTS__
+#define __HAPTICDEVICE_IBUTTONEVENTS__
+
+namespace hapticdevice {
+
+/**
+ * Press or release of a button.
+ */
+struct ButtonEvent
+{
+    int    button;         /* Index of the button.                    */
+    bool   pressed;        /* True upon press, false upon release.    */
+    double stamp;          /* Time of the edge in the wrapper clock.  */
+};
+
+
+/**
+ * Edges of the buttons detected by the device at servo rate and
+ * queued in order, so that clicks shorter than the publication
+ * period are not missed. Drivers offering it are reachable through
+ * PolyDriver::view(), as is the hapticdeviceclient, which receives
+ * the events from the wrapper.
+ */
+class IHapticButtonEvents
+{
+public:
+    virtual ~IHapticButtonEvents() { }
+
+    /**
+     * Pop the oldest event of the queue.
+     * @param event the event.
+     * @return true/false on success/failure, i.e. if the queue
+     *         is empty.
+     */
+    virtual bool getButtonEvent(ButtonEvent &event) = 0;
+
+    /**
+     * Get how many events went lost because the queue was full.
+     * @param lost the number of lost events.
+     * @return true/false on success/failure.
+     */
+    virtual bool getLostButtonEvents(unsigned long &lost) = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_ICLIENT__
+#define __HAPTICDEVICE_ICLIENT__
+
+#include <string>
+#include <future>
+#include <optional>
+
+#include <yarp/sig/Vector.h>
+#include <yarp/sig/Matrix.h>
+
+#include "IHapticButtonEvents.h"
+
+namespace hapticdevice {
+
+/**
+ * Snapshot of the device state as carried by one sample.
+ */
+struct HapticState
+{
+    double position[3];    /* Position in m.                          */
+    double orientation[3]; /* Gimbal angles in rad.                   */
+    double buttons[2];     /* Buttons state.                          */
+    double stamp;          /* Acquisition time in the wrapper clock.  */
+    int    sequence;       /* Sample counter assigned by the wrapper. */
+};
+
+
+/**
+ * Callback invoked by the hapticdeviceclient upon each new sample.
+ */
+class HapticStateCallback
+{
+public:
+    virtual ~HapticStateCallback() { }
+
+    /**
+     * Called from the thread receiving the samples, hence it
+     * should return quickly not to delay the next ones.
+     * @param state the state just received.
+     */
+    virtual void onState(const HapticState &state) = 0;
+};
+
+
+/**
+ * Services offered by the hapticdeviceclient on top of IHapticDevice,
+ * reachable through PolyDriver::view().
+ */
+class IHapticDeviceClient
+{
+public:
+    virtual ~IHapticDeviceClient() { }
+
+    /**
+     * Get pose, buttons, stamp and sequence number of the last
+     * received sample, all coming from the same sample. The call
+     * takes no lock and performs no allocation.
+     * @param state the last received state.
+     * @return true/false on success/failure, i.e. if no sample
+     *         has been received yet.
+     */
+    virtual bool getState(HapticState &state) = 0;
+
+    /**
+     * Get the state at a past time by interpolating the two received
+     * samples enclosing it: linearly for the position and spherically
+     * for the orientation, whose angles are handled as roll-pitch-yaw;
+     * the buttons and the sequence number are those of the closest
+     * sample. Only the times covered by the option "history-size"
+     * can be served.
+     * @param t the time in the wrapper clock (see toLocalTime()).
+     * @param state the state at the given time.
+     * @return true/false on success/failure.
+     */
+    virtual bool getStateAt(const double t, HapticState &state) = 0;
+
+    /**
+     * Wait for a sample newer than those received so far.
+     * @param state the new state.
+     * @param timeout the maximum time to wait for in seconds;
+     *                a non-positive value waits indefinitely.
+     * @return true/false on success/failure, i.e. upon timeout or
+     *         when the client gets closed.
+     */
+    virtual bool waitForNextState(HapticState &state,
+                                  const double timeout = 0.0) = 0;
+
+    /**
+     * Register a callback fired upon each new sample. The callbacks
+     * run on the thread receiving the samples, and may register and
+     * unregister callbacks, themselves included.
+     * @param callback the callback object, which must outlive
+     *                 its registration.
+     * @return true/false on success/failure.
+     */
+    virtual bool registerStateCallback(HapticStateCallback *callback) = 0;
+
+    /**
+     * Unregister a callback, waiting for its possible ongoing
+     * invocation to complete; when called from within a callback,
+     * it returns straightaway and the unregistered callback is not
+     * invoked anymore, not even later within the same sample.
+     * @param callback the callback object.
+     * @return true/false on success/failure.
+     */
+    virtual bool unregisterStateCallback(HapticStateCallback *callback) = 0;
+
+    /**
+     * Get the position extrapolated to the present time.
+     * Requires the option "prediction-horizon" to be positive.
+     * @param pos the predicted position.
+     * @return true/false on success/failure.
+     */
+    virtual bool getPredictedPosition(yarp::sig::Vector &pos) = 0;
+
+    /**
+     * Get the orientation extrapolated to the present time.
+     * Requires the option "prediction-horizon" to be positive.
+     * @param rpy the predicted orientation.
+     * @return true/false on success/failure.
+     */
+    virtual bool getPredictedOrientation(yarp::sig::Vector &rpy) = 0;
+
+    /**
+     * Get how far in time the predicted pose has been extrapolated
+     * beyond the last received sample.
+     * @param age the extrapolation span in seconds.
+     * @return true/false on success/failure.
+     */
+    virtual bool getPredictionAge(double &age) = 0;
+
+    /**
+     * Get the estimated offset between the wrapper clock and the
+     * local clock, as remote time minus local time.
+     * Requires the option "clock-sync-period" to be positive.
+     * @param offset the offset in seconds at the present time.
+     * @param drift the rate at which the offset changes.
+     * @return true/false on success/failure.
+     */
+    virtual bool getClockOffset(double &offset, double &drift) = 0;
+
+    /**
+     * Convert a time stamped by the wrapper into the local clock.
+     * @param remote the time as stamped by the wrapper.
+     * @param local the same time expressed in the local clock.
+     * @return true/false on success/failure.
+     */
+    virtual bool toLocalTime(const double remote, double &local) = 0;
+
+    /**
+     * Get the age of the last received sample in the local clock.
+     * @param age the time elapsed since the sample was acquired.
+     * @return true/false on success/failure.
+     */
+    virtual bool getSampleAge(double &age) = 0;
+
+    /**
+     * Wait for a button event and pop it, the events received
+     * earlier being popped first (see IHapticButtonEvents).
+     * @param event the event.
+     * @param timeout the maximum time to wait for in seconds;
+     *                a non-positive value waits indefinitely.
+     * @return true/false on success/failure, i.e. upon timeout or
+     *         when the client gets closed.
+     */
+    virtual bool waitForButtonEvent(ButtonEvent &event,
+                                    const double timeout = 0.0) = 0;
+
+    /**
+     * Asynchronous counterparts of the IHapticDevice configuration
+     * calls: requests are pipelined to the wrapper and the returned
+     * futures become ready as the replies come back, possibly out
+     * of order. Getters served by the cache return ready futures;
+     * empty optionals and false values signal failures.
+     */
+
+    /**
+     * Asynchronous version of IHapticDevice::isCartesianForceModeEnabled().
+     * @return the future mode, true for cartesian force mode.
+     */
+    virtual std::future<std::optional<bool>> isCartesianForceModeEnabledAsync() = 0;
+
+    /**
+     * Asynchronous version of IHapticDevice::setCartesianForceMode().
+     * @return the future outcome, true/false on success/failure.
+     */
+    virtual std::future<bool> setCartesianForceModeAsync() = 0;
+
+    /**
+     * Asynchronous version of IHapticDevice::setJointTorqueMode().
+     * @return the future outcome, true/false on success/failure.
+     */
+    virtual std::future<bool> setJointTorqueModeAsync() = 0;
+
+    /**
+     * Asynchronous version of IHapticDevice::getMaxFeedback().
+     * @return the future maximum values of the feedback.
+     */
+    virtual std::future<std::optional<yarp::sig::Vector>> getMaxFeedbackAsync() = 0;
+
+    /**
+     * Asynchronous version of IHapticDevice::stopFeedback().
+     * @return the future outcome, true/false on success/failure.
+     */
+    virtual std::future<bool> stopFeedbackAsync() = 0;
+
+    /**
+     * Asynchronous version of IHapticDevice::getTransformation().
+     * @return the future transformation matrix.
+     */
+    virtual std::future<std::optional<yarp::sig::Matrix>> getTransformationAsync() = 0;
+
+    /**
+     * Asynchronous version of IHapticDevice::setTransformation().
+     * @param T the transformation matrix.
+     * @return the future outcome, true/false on success/failure.
+     */
+    virtual std::future<bool> setTransformationAsync(const yarp::sig::Matrix &T) = 0;
+
+    /**
+     * Tell whether the state stream has stopped flowing for longer
+     * than the option "stale-timeout", in which case the getters keep
+     * serving the last received sample while the client reconnects.
+     * @param stale true if the last received sample is stale.
+     * @return true/false on success/failure.
+     */
+    virtual bool isStateStale(bool &stale) = 0;
+
+    /**
+     * Get the stem-name of the wrapper currently in use among those
+     * listed in the option "remote".
+     * @param remote the stem-name of the wrapper.
+     * @return true/false on success/failure.
+     */
+    virtual bool getActiveRemote(std::string &remote) = 0;
+
+    /**
+     * Get how long the state stream stayed interrupted, measured from
+     * the last sample before the outage to the first one after it.
+     * @param last the duration of the last outage in seconds.
+     * @param worst the duration of the longest outage in seconds.
+     * @return true/false if any outage has been recovered/otherwise.
+     */
+    virtual bool getRecoveryTime(double &last, double &worst) = 0;
+};
+
+}
+
+#endif
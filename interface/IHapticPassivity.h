@@ -0,0 +1,42 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_IPASSIVITY__
+#define __HAPTICDEVICE_IPASSIVITY__
+
+namespace hapticdevice {
+
+/**
+ * Telemetry of the passivity controller that the device runs at
+ * servo rate on the force feedback, to keep the loop stable when
+ * the forces are delayed. Drivers offering it are reachable through
+ * PolyDriver::view(), as is the hapticdeviceclient, which forwards
+ * the calls to the wrapper.
+ */
+class IHapticPassivity
+{
+public:
+    virtual ~IHapticPassivity() { }
+
+    /**
+     * Get the state of the passivity controller.
+     * @param energy the energy stored by the feedback port in J; it
+     *               gets negative only when the damping saturates.
+     * @param damping the damping injected in the last cycle in Ns/m.
+     * @param dissipated the energy dissipated so far in J.
+     * @param active the cycles in which the damping was injected.
+     * @return true/false on success/failure.
+     */
+    virtual bool getPassivity(double &energy, double &damping,
+                              double &dissipated, int &active) = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#ifndef __HAPTICDEVICE_IRENDERER__
+#define __HAPTICDEVICE_IRENDERER__
+
+#include <vector>
+
+#include <yarp/sig/Vector.h>
+
+namespace hapticdevice {
+
+/**
+ * Contact rendering against a static triangle mesh, carried out by
+ * the device at servo rate on top of the force feedback. Drivers
+ * offering it are reachable through PolyDriver::view(), as is the
+ * hapticdeviceclient, which forwards the calls to the wrapper.
+ */
+class IHapticRenderer
+{
+public:
+    virtual ~IHapticRenderer() { }
+
+    /**
+     * Upload the mesh to render the contacts against, replacing the
+     * previous one.
+     * @param vertices the coordinates x y z of the vertices in m,
+     *                 expressed in the frame of the positions.
+     * @param triangles the triplets of indexes of the vertices.
+     * @return true/false on success/failure.
+     */
+    virtual bool setMesh(const std::vector<double> &vertices,
+                         const std::vector<int> &triangles) = 0;
+
+    /**
+     * Remove the mesh, thus stopping the rendering.
+     * @return true/false on success/failure.
+     */
+    virtual bool clearMesh() = 0;
+
+    /**
+     * Set the properties of the surface.
+     * @param stiffness the stiffness in N/m.
+     * @param damping the damping in Ns/m.
+     * @return true/false on success/failure.
+     */
+    virtual bool setContactParameters(const double stiffness,
+                                      const double damping) = 0;
+
+    /**
+     * Get the state of the contact.
+     * @param contact true if the device is pushing against the mesh.
+     * @param proxy the position of the proxy on the surface in m.
+     * @param force the contact force in N.
+     * @return true/false on success/failure.
+     */
+    virtual bool getContact(bool &contact, yarp::sig::Vector &proxy,
+                            yarp::sig::Vector &force) = 0;
+
+    /**
+     * Get how demanding the rendering is for the servo loop.
+     * @param worst the longest time spent rendering a frame in s.
+     * @param exhausted the frames that ran out of query budget,
+     *                  holding the previous proxy.
+     * @return true/false on success/failure.
+     */
+    virtual bool getRenderStats(double &worst, int &exhausted) = 0;
+};
+
+}
+
+#endif
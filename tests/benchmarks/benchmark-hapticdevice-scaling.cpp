@@ -0,0 +1,335 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/dev/Drivers.h>
+#include <yarp/sig/all.h>
+
+#include "hapticdeviceWrapper.h"
+#include "hapticdeviceClient.h"
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+
+
+/**********************************************************/
+class SyntheticDevice : public DeviceDriver, public IHapticDevice
+{
+public:
+    bool getPosition(Vector &pos) override
+    {
+        double t=Time::now();
+        pos.resize(3); pos[0]=0.1*sin(t); pos[1]=0.1*cos(t); pos[2]=0.05*sin(2.0*t);
+        return true;
+    }
+    bool getOrientation(Vector &rpy) override    { rpy.resize(3); rpy[0]=rpy[1]=rpy[2]=0.0; return true; }
+    bool getButtons(Vector &buttons) override    { buttons.resize(2); buttons[0]=buttons[1]=0.0; return true; }
+    bool isCartesianForceModeEnabled(bool &ret) override { ret=true; return true; }
+    bool setCartesianForceMode() override        { return true;                }
+    bool setJointTorqueMode() override           { return true;                }
+    bool getMaxFeedback(Vector &max) override    { max.resize(3,1.0); return true; }
+    bool setFeedback(const Vector &fdbck) override { return true;              }
+    bool stopFeedback() override                 { return true;                }
+    bool getTransformation(Matrix &T) override   { T.resize(4,4); T.eye(); return true; }
+    bool setTransformation(const Matrix &T) override { return true;            }
+};
+
+
+/**********************************************************/
+static double threadCpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+    return ts.tv_sec+1e-9*ts.tv_nsec;
+}
+
+
+/**********************************************************/
+class TimedWrapper : public HapticDeviceWrapper
+{
+    void run() override
+    {
+        double t0=threadCpuTime();
+        HapticDeviceWrapper::run();
+        if (armed)
+        {
+            cpu+=threadCpuTime()-t0;
+            cycles++;
+        }
+    }
+
+public:
+    atomic<bool> armed{false};
+    double cpu{0.0};
+    long cycles{0};
+};
+
+
+/**********************************************************/
+class ClientProbe : public hapticdevice::HapticStateCallback
+{
+public:
+    atomic<bool> armed{false};
+    vector<double> latencies;
+    int firstSeq{-1},lastSeq{-1};
+    long received{0};
+
+    void onState(const hapticdevice::HapticState &state) override
+    {
+        if (!armed)
+            return;
+
+        if (firstSeq<0)
+            firstSeq=state.sequence;
+        lastSeq=state.sequence;
+        received++;
+
+        // wrapper and clients share the same clock
+        if (latencies.size()<latencies.capacity())
+            latencies.push_back(Time::now()-state.stamp);
+    }
+};
+
+
+/**********************************************************/
+static double percentile(const vector<double> &sorted, const double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t i=std::min(sorted.size()-1,(size_t)(p*(sorted.size()-1)+0.5));
+    return sorted[i];
+}
+
+
+/**********************************************************/
+class Point
+{
+public:
+    double rate;
+    int clients;
+    double minRate,meanRate,loss;
+    double p50,p90,p99,max;
+    double wrapperCpu,cycleCpu,processCpu;
+
+    string toJson() const
+    {
+        ostringstream str;
+        str<<"    {\"rate_hz\": "<<rate<<", \"clients\": "<<clients
+           <<", \"delivered_hz_min\": "<<minRate<<", \"delivered_hz_mean\": "<<meanRate
+           <<", \"loss\": "<<loss
+           <<", \"latency_us_p50\": "<<1e6*p50<<", \"latency_us_p90\": "<<1e6*p90
+           <<", \"latency_us_p99\": "<<1e6*p99<<", \"latency_us_max\": "<<1e6*max
+           <<", \"wrapper_cpu\": "<<wrapperCpu<<", \"wrapper_cycle_us\": "<<1e6*cycleCpu
+           <<", \"process_cpu\": "<<processCpu<<"}";
+        return str.str();
+    }
+};
+
+
+/**********************************************************/
+bool measure(const int round, const double rate, const int n,
+             const Property &options, const double duration, Point &point)
+{
+    string stem="benchmark-scaling-"+to_string(round);
+
+    PolyDriver drvDevice;
+    Property optDevice("(device benchmark_scaling_device)");
+    TimedWrapper wrapper;
+    Property optWrapper=options;
+    optWrapper.put("name",stem);
+    if (!drvDevice.open(optDevice) || !wrapper.open(optWrapper))
+    {
+        yError("unable to set up the wrapper!");
+        return false;
+    }
+    wrapper.setPeriod(1.0/rate);
+    wrapper.attach(&drvDevice);
+
+    vector<unique_ptr<PolyDriver>> drivers;
+    vector<unique_ptr<ClientProbe>> probes;
+    bool ok=true;
+    for (int i=0; (i<n) && ok; i++)
+    {
+        Property optClient=options;
+        optClient.put("device","hapticdeviceclient");
+        optClient.put("remote","/"+stem);
+        optClient.put("local","/"+stem+"-client/"+to_string(i));
+
+        drivers.push_back(unique_ptr<PolyDriver>(new PolyDriver));
+        probes.push_back(unique_ptr<ClientProbe>(new ClientProbe));
+        probes.back()->latencies.reserve((size_t)(1.5*rate*duration)+1);
+
+        hapticdevice::IHapticDeviceClient *iclient;
+        ok=drivers.back()->open(optClient) && drivers.back()->view(iclient) &&
+           iclient->registerStateCallback(probes.back().get());
+    }
+
+    if (ok)
+    {
+        // let the connections settle before measuring
+        Time::delay(0.5);
+
+        for (auto &p:probes)
+            p->armed=true;
+        wrapper.armed=true;
+        clock_t cpu0=std::clock();
+        double t0=Time::now();
+
+        Time::delay(duration);
+
+        wrapper.armed=false;
+        for (auto &p:probes)
+            p->armed=false;
+        double span=Time::now()-t0;
+        clock_t cpu1=std::clock();
+
+        // let the callbacks in flight complete
+        Time::delay(0.1);
+
+        vector<double> latencies;
+        double sumRate=0.0,minRate=rate;
+        long expected=0,received=0;
+        for (auto &p:probes)
+        {
+            double r=p->received/span;
+            sumRate+=r;
+            minRate=std::min(minRate,r);
+            if (p->firstSeq>=0)
+                expected+=p->lastSeq-p->firstSeq+1;
+            received+=p->received;
+            latencies.insert(latencies.end(),p->latencies.begin(),p->latencies.end());
+        }
+        sort(latencies.begin(),latencies.end());
+
+        point.rate=rate;
+        point.clients=n;
+        point.minRate=(n>0)?minRate:0.0;
+        point.meanRate=(n>0)?sumRate/n:0.0;
+        point.loss=(expected>0)?1.0-(double)received/expected:0.0;
+        point.p50=percentile(latencies,0.5);
+        point.p90=percentile(latencies,0.9);
+        point.p99=percentile(latencies,0.99);
+        point.max=latencies.empty()?0.0:latencies.back();
+        point.wrapperCpu=wrapper.cpu/span;
+        point.cycleCpu=(wrapper.cycles>0)?wrapper.cpu/wrapper.cycles:0.0;
+        point.processCpu=(double)(cpu1-cpu0)/CLOCKS_PER_SEC/span;
+    }
+    else
+        yError("unable to set up the clients!");
+
+    for (auto &d:drivers)
+        d->close();
+    wrapper.stop();
+    wrapper.close();
+    drvDevice.close();
+
+    return ok;
+}
+
+
+/**********************************************************/
+static vector<double> readList(ResourceFinder &rf, const string &key,
+                               const vector<double> &defaults)
+{
+    if (!rf.check(key))
+        return defaults;
+
+    vector<double> values;
+    if (Bottle *list=rf.find(key).asList())
+        for (size_t i=0; i<list->size(); i++)
+            values.push_back(list->get(i).asFloat64());
+    else
+        values.push_back(rf.find(key).asFloat64());
+    return values;
+}
+
+
+/**********************************************************/
+int main(int argc,char *argv[])
+{
+    Network yarp;
+    Network::setLocalMode(true);
+
+    ResourceFinder rf;
+    rf.configure(argc,argv);
+    double duration=rf.check("duration",Value(3.0)).asFloat64();
+    string output=rf.check("output",Value("")).asString();
+    vector<double> rates=readList(rf,"rates",{100.0,500.0,1000.0});
+    vector<double> clients=readList(rf,"clients",{1,2,4,8,16,32});
+
+    // forwarded to both the wrapper and the clients
+    Property options;
+    options.put("publish-mode",rf.check("publish-mode",Value("strict")).asString());
+    options.put("state-carrier",rf.check("carrier",Value("tcp")).asString());
+    options.put("stale-timeout",rf.check("stale-timeout",Value(1.0)).asFloat64());
+
+    Drivers::factory().add(new DriverCreatorOf<SyntheticDevice>("benchmark_scaling_device","","SyntheticDevice"));
+    Drivers::factory().add(new DriverCreatorOf<HapticDeviceClient>("hapticdeviceclient","","HapticDeviceClient"));
+
+    vector<Point> curve;
+    int round=0;
+    for (auto rate:rates)
+    {
+        for (auto n:clients)
+        {
+            Point point;
+            if (!measure(round++,rate,(int)n,options,duration,point))
+                return 1;
+
+            yInfo("rate=%g Hz clients=%d: delivered=%.1f/%.1f Hz (min/mean) loss=%.2f%% "
+                  "latency [us] p50=%.0f p99=%.0f max=%.0f; wrapper CPU=%.1f%% (%.1f us/cycle)",
+                  point.rate,point.clients,point.minRate,point.meanRate,100.0*point.loss,
+                  1e6*point.p50,1e6*point.p99,1e6*point.max,
+                  100.0*point.wrapperCpu,1e6*point.cycleCpu);
+            curve.push_back(point);
+        }
+    }
+
+    ostringstream json;
+    json<<"{"<<endl;
+    json<<"  \"suite\": \"hapticdevice-scaling\","<<endl;
+    json<<"  \"publish_mode\": \""<<options.find("publish-mode").asString()<<"\","<<endl;
+    json<<"  \"carrier\": \""<<options.find("state-carrier").asString()<<"\","<<endl;
+    json<<"  \"duration_s\": "<<duration<<","<<endl;
+    json<<"  \"curve\": ["<<endl;
+    for (size_t i=0; i<curve.size(); i++)
+        json<<curve[i].toJson()<<((i+1<curve.size())?",":"")<<endl;
+    json<<"  ]"<<endl;
+    json<<"}"<<endl;
+
+    if (output.empty())
+        cout<<json.str();
+    else
+    {
+        ofstream fout(output);
+        if (!fout.is_open())
+        {
+            yError("unable to write %s!",output.c_str());
+            return 1;
+        }
+        fout<<json.str();
+        yInfo("scaling curve written to %s",output.c_str());
+    }
+
+    return 0;
+}
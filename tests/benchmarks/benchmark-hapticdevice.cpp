@@ -0,0 +1,467 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/sig/all.h>
+#include <yarp/math/Math.h>
+
+#include "common.h"
+#include "hapticdeviceWrapper.h"
+#include "hapticdeviceClient.h"
+
+#ifdef HAPTICDEVICE_BENCHMARK_DRIVER
+    #include "geomagicDriver.h"
+#endif
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+using namespace yarp::math;
+
+typedef chrono::steady_clock Clock;
+
+
+/**********************************************************/
+class Results
+{
+    vector<string> entries;
+
+public:
+    void add(const string &name, const vector<pair<string,double>> &metrics)
+    {
+        ostringstream str;
+        str<<"    {\"name\": \""<<name<<"\"";
+        for (auto &m:metrics)
+            str<<", \""<<m.first<<"\": "<<m.second;
+        str<<"}";
+        entries.push_back(str.str());
+        yInfo("%s",entries.back().c_str()+4);
+    }
+
+    void dump(ostream &out) const
+    {
+        out<<"{"<<endl;
+        out<<"  \"suite\": \"hapticdevice\","<<endl;
+        out<<"  \"threads\": "<<thread::hardware_concurrency()<<","<<endl;
+        out<<"  \"results\": ["<<endl;
+        for (size_t i=0; i<entries.size(); i++)
+            out<<entries[i]<<((i+1<entries.size())?",":"")<<endl;
+        out<<"  ]"<<endl;
+        out<<"}"<<endl;
+    }
+};
+
+
+/**********************************************************/
+template <typename F>
+double nsPerOp(F &&f, const int iterations)
+{
+    for (int i=0; i<iterations/10; i++)
+        f();
+
+    auto t0=Clock::now();
+    for (int i=0; i<iterations; i++)
+        f();
+    auto t1=Clock::now();
+
+    return chrono::duration<double,nano>(t1-t0).count()/iterations;
+}
+
+
+/**********************************************************/
+class StandInDevice : public DeviceDriver, public IHapticDevice,
+                      public hapticdevice::IHapticRenderer,
+                      public hapticdevice::IHapticPassivity
+{
+    double t{0.0};
+
+public:
+    void step()                                  { t+=0.001;                   }
+    bool getPosition(Vector &pos) override       { pos.resize(3); pos[0]=t; pos[1]=-t; pos[2]=2.0*t; return true; }
+    bool getOrientation(Vector &rpy) override    { rpy.resize(3); rpy[0]=rpy[1]=rpy[2]=t; return true; }
+    bool getButtons(Vector &buttons) override    { buttons.resize(2); buttons[0]=buttons[1]=0.0; return true; }
+    bool isCartesianForceModeEnabled(bool &ret) override { ret=true; return true; }
+    bool setCartesianForceMode() override        { return true;                }
+    bool setJointTorqueMode() override           { return true;                }
+    bool getMaxFeedback(Vector &max) override    { max.resize(3,1.0); return true; }
+    bool setFeedback(const Vector &fdbck) override { return true;              }
+    bool stopFeedback() override                 { return true;                }
+    bool getTransformation(Matrix &T) override   { T=eye(4,4); return true;    }
+    bool setTransformation(const Matrix &T) override { return true;            }
+
+    // IHapticRenderer and IHapticPassivity
+    bool setMesh(const vector<double> &vertices, const vector<int> &triangles) override { return true; }
+    bool clearMesh() override                    { return true;                }
+    bool setContactParameters(const double stiffness, const double damping) override { return true; }
+    bool getContact(bool &contact, Vector &proxy, Vector &force) override
+    {
+        contact=false; proxy.resize(3,0.0); force.resize(3,0.0);
+        return true;
+    }
+    bool getRenderStats(double &worst, int &exhausted) override { worst=0.0; exhausted=0; return true; }
+    bool getPassivity(double &energy, double &damping, double &dissipated, int &active) override
+    {
+        energy=damping=dissipated=0.0; active=0;
+        return true;
+    }
+};
+
+
+/**********************************************************/
+class ProbeWrapper : public HapticDeviceWrapper
+{
+public:
+    bool init(StandInDevice *device)
+    {
+        this->device=device;
+        this->renderer=device;
+        this->passivity=device;
+        return threadInit();
+    }
+
+    void release() { threadRelease(); }
+    void sample()  { sampleState();   }
+    void cycle()   { run();           }
+};
+
+
+/**********************************************************/
+class ProbeClient : public HapticDeviceClient
+{
+public:
+    ProbeClient()
+    {
+        statePort.setClient(this);
+    }
+
+    void deliver(Vector &sample)
+    {
+        static_cast<TypedReaderCallback<Vector>&>(statePort).onRead(sample);
+    }
+};
+
+
+#ifdef HAPTICDEVICE_BENCHMARK_DRIVER
+/**********************************************************/
+void benchDriver(Results &results, const int iterations)
+{
+    GeomagicDriver driver;
+    Property options;
+    options.put("device-id","stand-in");
+    if (!driver.open(options))
+    {
+        yError("unable to open the driver against the stand-in backend!");
+        return;
+    }
+
+    // wait for the first exchange with the servo thread
+    Vector pos,rpy,buttons,max,fdbck(3,0.0);
+    while (!driver.getPosition(pos))
+        this_thread::sleep_for(chrono::milliseconds(1));
+
+    results.add("driver.getPosition",
+                {{"ns_per_op",nsPerOp([&]() { driver.getPosition(pos); },iterations)}});
+    results.add("driver.getOrientation",
+                {{"ns_per_op",nsPerOp([&]() { driver.getOrientation(rpy); },iterations)}});
+    results.add("driver.getButtons",
+                {{"ns_per_op",nsPerOp([&]() { driver.getButtons(buttons); },iterations)}});
+    results.add("driver.getMaxFeedback",
+                {{"ns_per_op",nsPerOp([&]() { driver.getMaxFeedback(max); },iterations)}});
+    results.add("driver.setFeedback",
+                {{"ns_per_op",nsPerOp([&]() { fdbck[0]+=1e-6; driver.setFeedback(fdbck); },iterations)}});
+
+    driver.stopFeedback();
+    driver.close();
+}
+#endif
+
+
+/**********************************************************/
+void benchWrapper(Results &results, ProbeWrapper &wrapper,
+                  StandInDevice &device, const int iterations)
+{
+    results.add("wrapper.sampleState",
+                {{"ns_per_op",nsPerOp([&]() { device.step(); wrapper.sample(); },iterations)}});
+    results.add("wrapper.run",
+                {{"ns_per_op",nsPerOp([&]() { device.step(); wrapper.cycle(); },iterations)}});
+}
+
+
+/**********************************************************/
+void benchClient(Results &results, const int iterations,
+                 const vector<int> &readers)
+{
+    for (auto n:readers)
+    {
+        ProbeClient client;
+        Vector sample(8,0.0);
+
+        atomic<bool> stop{false};
+        atomic<long> reads{0};
+        vector<thread> threads;
+        for (int i=0; i<n; i++)
+        {
+            threads.push_back(thread([&]() {
+                hapticdevice::HapticState state;
+                Vector pos;
+                long cnt=0;
+                while (!stop.load(memory_order_relaxed))
+                {
+                    client.getState(state);
+                    client.getPosition(pos);
+                    cnt+=2;
+                }
+                reads+=cnt;
+            }));
+        }
+
+        auto t0=Clock::now();
+        double deliver=nsPerOp([&]() { sample[0]+=0.001; client.deliver(sample); },iterations);
+        stop=true;
+        for (auto &t:threads)
+            t.join();
+        double elapsed=chrono::duration<double>(Clock::now()-t0).count();
+
+        vector<pair<string,double>> metrics;
+        metrics.push_back({"readers",n});
+        metrics.push_back({"ns_per_op",deliver});
+        if (n>0)
+            metrics.push_back({"reads_per_s",reads/elapsed});
+        results.add("client.onRead",metrics);
+    }
+
+    // getters alone, with no concurrent writer
+    ProbeClient client;
+    Vector sample(8,0.0),pos,rpy,buttons;
+    hapticdevice::HapticState state;
+    client.deliver(sample);
+
+    results.add("client.getPosition",
+                {{"ns_per_op",nsPerOp([&]() { client.getPosition(pos); },iterations)}});
+    results.add("client.getOrientation",
+                {{"ns_per_op",nsPerOp([&]() { client.getOrientation(rpy); },iterations)}});
+    results.add("client.getButtons",
+                {{"ns_per_op",nsPerOp([&]() { client.getButtons(buttons); },iterations)}});
+    results.add("client.getState",
+                {{"ns_per_op",nsPerOp([&]() { client.getState(state); },iterations)}});
+}
+
+
+/**********************************************************/
+void benchRpc(Results &results, const string &server, const int iterations)
+{
+    RpcClient port;
+    port.open("/benchmark-hapticdevice/rpc");
+    if (!Network::connect(port.getName(),server))
+    {
+        yError("unable to connect to %s!",server.c_str());
+        port.close();
+        return;
+    }
+
+    Matrix T=eye(4,4);
+    vector<pair<string,Bottle>> commands;
+    auto command=[&](const string &name, const int vocab) -> Bottle& {
+        commands.push_back({name,Bottle()});
+        commands.back().second.addVocab32(vocab);
+        return commands.back().second;
+    };
+
+    command("rpc.get_transformation",hapticdevice::get_transformation);
+    command("rpc.set_transformation",hapticdevice::set_transformation).addList().read(T);
+    command("rpc.stop_feedback",hapticdevice::stop_feedback);
+    command("rpc.is_cartesian",hapticdevice::is_cartesian);
+    command("rpc.set_cartesian",hapticdevice::set_cartesian);
+    command("rpc.set_joint",hapticdevice::set_joint);
+    command("rpc.get_max",hapticdevice::get_max);
+    command("rpc.get_time",hapticdevice::get_time);
+    command("rpc.get_stats",hapticdevice::get_stats);
+
+    // a single triangle, so as to time the transport rather than the tree
+    Bottle &mesh=command("rpc.set_mesh",hapticdevice::set_mesh);
+    mesh.addList().fromString("0.0 0.0 0.0 0.1 0.0 0.0 0.0 0.1 0.0");
+    mesh.addList().fromString("0 1 2");
+
+    Bottle &contact=command("rpc.set_contact",hapticdevice::set_contact);
+    contact.addFloat64(500.0);
+    contact.addFloat64(5.0);
+
+    command("rpc.get_contact",hapticdevice::get_contact);
+    command("rpc.clear_mesh",hapticdevice::clear_mesh);
+    command("rpc.get_passivity",hapticdevice::get_passivity);
+
+    vector<double> samples(iterations);
+    for (auto &c:commands)
+    {
+        Bottle rep;
+        for (int i=0; i<iterations/10; i++)
+            port.write(c.second,rep);
+
+        for (auto &s:samples)
+        {
+            auto t0=Clock::now();
+            port.write(c.second,rep);
+            s=chrono::duration<double,micro>(Clock::now()-t0).count();
+        }
+
+        if (rep.get(0).asVocab32()!=hapticdevice::ack)
+            yWarning("%s was not acknowledged",c.first.c_str());
+
+        double mean=0.0;
+        for (auto s:samples)
+            mean+=s;
+        mean/=samples.size();
+
+        sort(samples.begin(),samples.end());
+        results.add(c.first,{{"mean_us",mean},
+                             {"p50_us",samples[samples.size()/2]},
+                             {"p99_us",samples[(samples.size()*99)/100]}});
+    }
+
+    port.close();
+}
+
+
+/**********************************************************/
+void benchStartup(Results &results, const string &remote, const int startups)
+{
+    auto report=[&](const string &name, vector<double> &samples) {
+        double mean=0.0;
+        for (auto s:samples)
+            mean+=s;
+        mean/=samples.size();
+
+        sort(samples.begin(),samples.end());
+        results.add(name,{{"mean_ms",mean},
+                          {"p50_ms",samples[samples.size()/2]},
+                          {"max_ms",samples.back()}});
+    };
+
+    // registration of the wrapper ports
+    vector<double> samples(startups);
+    for (auto &s:samples)
+    {
+        Property options;
+        options.put("name","benchmark-startup");
+        StandInDevice device;
+        ProbeWrapper wrapper;
+        wrapper.open(options);
+
+        auto t0=Clock::now();
+        wrapper.init(&device);
+        s=chrono::duration<double,milli>(Clock::now()-t0).count();
+
+        wrapper.release();
+        wrapper.close();
+    }
+    report("wrapper.startup",samples);
+
+    // ports and connections of the client
+    for (auto &s:samples)
+    {
+        Property options;
+        options.put("device","hapticdeviceclient");
+        options.put("remote",remote);
+        options.put("local","/benchmark-hapticdevice/startup");
+        options.put("clock-sync-period",0.0);
+        options.put("stale-timeout",0.0);
+
+        HapticDeviceClient client;
+        auto t0=Clock::now();
+        if (!client.open(options))
+        {
+            yError("unable to open the client!");
+            return;
+        }
+        s=chrono::duration<double,milli>(Clock::now()-t0).count();
+        client.close();
+    }
+    report("client.startup",samples);
+}
+
+
+/**********************************************************/
+int main(int argc,char *argv[])
+{
+    Network::setLocalMode(true);
+    Network yarp;
+
+    ResourceFinder rf;
+    rf.configure(argc,argv);
+    int iterations=rf.check("iterations",Value(100000)).asInt32();
+    int roundTrips=rf.check("round-trips",Value(1000)).asInt32();
+    int startups=std::max(1,rf.check("startups",Value(20)).asInt32());
+    string output=rf.check("output",Value("")).asString();
+
+    vector<int> readers={0,1,2,4};
+    if (rf.check("readers"))
+    {
+        readers.clear();
+        if (Bottle *list=rf.find("readers").asList())
+            for (size_t i=0; i<list->size(); i++)
+                readers.push_back(list->get(i).asInt32());
+        else
+            readers.push_back(rf.find("readers").asInt32());
+    }
+
+    Results results;
+
+#ifdef HAPTICDEVICE_BENCHMARK_DRIVER
+    benchDriver(results,iterations);
+#endif
+
+    Property options;
+    options.put("name","benchmark-wrapper");
+    options.put("rpc-rate-limit",0.0);
+
+    StandInDevice device;
+    ProbeWrapper wrapper;
+    if (!wrapper.open(options) || !wrapper.init(&device))
+    {
+        yError("unable to set up the wrapper!");
+        return 1;
+    }
+
+    benchWrapper(results,wrapper,device,iterations);
+    benchClient(results,iterations,readers);
+    benchRpc(results,"/benchmark-wrapper/rpc",roundTrips);
+    benchStartup(results,"/benchmark-wrapper",startups);
+
+    wrapper.release();
+    wrapper.close();
+
+    if (output.empty())
+        results.dump(cout);
+    else
+    {
+        ofstream fout(output);
+        if (!fout.is_open())
+        {
+            yError("unable to write %s!",output.c_str());
+            return 1;
+        }
+        results.dump(fout);
+        yInfo("results written to %s",output.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,261 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+// Stand-in for the subset of HDAPI used by the Geomagic driver, so that
+// the driver can be benchmarked without the SDK runtime and the device.
+// A servo thread ticks at 1 kHz running the scheduled callbacks, while
+// the device reports a smooth motion of the stylus.
+
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <HD/hd.h>
+
+namespace {
+
+typedef decltype(HDErrorInfo::errorCode) ErrorCode;
+
+struct Servo
+{
+    std::mutex mtx;
+    std::condition_variable served;
+    std::thread thread;
+    bool running{false};
+    bool frame{false};
+    unsigned long tick{0};
+
+    std::vector<std::pair<HDSchedulerCallback,void*>> async;
+    std::vector<std::pair<HDSchedulerCallback,void*>> sync,batch;
+
+    std::chrono::steady_clock::time_point t0;
+    HDdouble force[3]{0.0,0.0,0.0};
+
+    void loop()
+    {
+        auto next=std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mtx);
+        while (running)
+        {
+            lock.unlock();
+            next+=std::chrono::microseconds(1000);
+            std::this_thread::sleep_until(next);
+            lock.lock();
+
+            for (size_t i=0; i<async.size(); i++)
+                if ((async[i].first!=nullptr) &&
+                    (async[i].first(async[i].second)==HD_CALLBACK_DONE))
+                    async[i].first=nullptr;
+
+            batch.swap(sync);
+            for (auto &cb:batch)
+                cb.first(cb.second);
+            batch.clear();
+
+            tick++;
+            served.notify_all();
+        }
+    }
+
+    double now() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    }
+};
+
+Servo servo;
+
+}
+
+
+/*********************************************************************/
+HHD hdInitDevice(HDstring pConfigName)
+{
+    servo.t0=std::chrono::steady_clock::now();
+    return 1;
+}
+
+
+/*********************************************************************/
+void hdDisableDevice(HHD hHD)
+{
+}
+
+
+/*********************************************************************/
+HHD hdGetCurrentDevice()
+{
+    return 1;
+}
+
+
+/*********************************************************************/
+HDErrorInfo hdGetError()
+{
+    HDErrorInfo error;
+    std::memset(&error,0,sizeof(error));
+    return error;
+}
+
+
+/*********************************************************************/
+HDstring hdGetErrorString(ErrorCode errorCode)
+{
+    return "no error";
+}
+
+
+/*********************************************************************/
+void hdEnable(HDenum cap)
+{
+}
+
+
+/*********************************************************************/
+void hdBeginFrame(HHD hHD)
+{
+    servo.frame=true;
+}
+
+
+/*********************************************************************/
+void hdEndFrame(HHD hHD)
+{
+    servo.frame=false;
+}
+
+
+/*********************************************************************/
+void hdGetIntegerv(HDenum pname, HDint *params)
+{
+    if (pname==HD_OUTPUT_DOF)
+        params[0]=3;
+    else if (pname==HD_CURRENT_BUTTONS)
+        params[0]=(static_cast<int>(servo.now())&0x01)?HD_DEVICE_BUTTON_1:0;
+    else
+        params[0]=0;
+}
+
+
+/*********************************************************************/
+void hdGetDoublev(HDenum pname, HDdouble *params)
+{
+    double t=servo.now();
+    double w=2.0*M_PI*0.5;
+    if (pname==HD_CURRENT_POSITION)
+    {
+        params[0]=50.0*std::sin(w*t);
+        params[1]=30.0*std::cos(w*t);
+        params[2]=20.0*std::sin(2.0*w*t);
+    }
+    else if (pname==HD_CURRENT_VELOCITY)
+    {
+        params[0]=50.0*w*std::cos(w*t);
+        params[1]=-30.0*w*std::sin(w*t);
+        params[2]=40.0*w*std::cos(2.0*w*t);
+    }
+    else if (pname==HD_CURRENT_GIMBAL_ANGLES)
+    {
+        params[0]=0.3*std::sin(w*t);
+        params[1]=-0.2*std::cos(w*t);
+        params[2]=0.1*std::sin(2.0*w*t);
+    }
+    else if (pname==HD_NOMINAL_MAX_FORCE)
+        params[0]=3.3;
+    else if ((pname==HD_MAX_WORKSPACE_DIMENSIONS) ||
+             (pname==HD_USABLE_WORKSPACE_DIMENSIONS))
+    {
+        const HDdouble box[6]={-200.0,-100.0,-100.0,200.0,200.0,100.0};
+        std::copy(box,box+6,params);
+    }
+    else
+        params[0]=0.0;
+}
+
+
+/*********************************************************************/
+void hdSetDoublev(HDenum pname, const HDdouble *params)
+{
+    if ((pname==HD_CURRENT_FORCE) || (pname==HD_CURRENT_JOINT_TORQUE))
+        std::copy(params,params+3,servo.force);
+}
+
+
+/*********************************************************************/
+HDSchedulerHandle hdScheduleAsynchronous(HDSchedulerCallback pCallback,
+                                         void *pUserData, HDushort nPriority)
+{
+    std::lock_guard<std::mutex> lock(servo.mtx);
+    servo.async.push_back(std::make_pair(pCallback,pUserData));
+    return servo.async.size();
+}
+
+
+/*********************************************************************/
+void hdScheduleSynchronous(HDSchedulerCallback pCallback, void *pUserData,
+                           HDushort nPriority)
+{
+    std::unique_lock<std::mutex> lock(servo.mtx);
+    if (!servo.running)
+    {
+        pCallback(pUserData);
+        return;
+    }
+
+    // the callback is served by the next tick
+    unsigned long tick=servo.tick;
+    servo.sync.push_back(std::make_pair(pCallback,pUserData));
+    servo.served.wait(lock,[tick]() { return (servo.tick!=tick) || !servo.running; });
+}
+
+
+/*********************************************************************/
+void hdUnschedule(HDSchedulerHandle hHandle)
+{
+    std::lock_guard<std::mutex> lock(servo.mtx);
+    if ((hHandle>0) && (hHandle<=servo.async.size()))
+        servo.async[hHandle-1].first=nullptr;
+}
+
+
+/*********************************************************************/
+void hdStartScheduler()
+{
+    std::lock_guard<std::mutex> lock(servo.mtx);
+    if (!servo.running)
+    {
+        servo.running=true;
+        servo.thread=std::thread(&Servo::loop,&servo);
+    }
+}
+
+
+/*********************************************************************/
+void hdStopScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(servo.mtx);
+        if (!servo.running)
+            return;
+        servo.running=false;
+    }
+    servo.thread.join();
+
+    // release whoever was still waiting for a tick
+    std::lock_guard<std::mutex> lock(servo.mtx);
+    servo.sync.clear();
+    servo.served.notify_all();
+}
@@ -0,0 +1,403 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/dev/Drivers.h>
+#include <yarp/sig/all.h>
+
+#include "common.h"
+#include "hapticdeviceWrapper.h"
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+
+
+/**********************************************************/
+class SyntheticDevice : public DeviceDriver, public IHapticDevice
+{
+public:
+    bool getPosition(Vector &pos) override       { pos.resize(3,0.0); return true; }
+    bool getOrientation(Vector &rpy) override    { rpy.resize(3,0.0); return true; }
+    bool getButtons(Vector &buttons) override    { buttons.resize(2,0.0); return true; }
+    bool isCartesianForceModeEnabled(bool &ret) override { ret=true; return true; }
+    bool setCartesianForceMode() override        { return true;                }
+    bool setJointTorqueMode() override           { return true;                }
+    bool getMaxFeedback(Vector &max) override    { max.resize(3,1.0); return true; }
+    bool setFeedback(const Vector &fdbck) override { return true;              }
+    bool stopFeedback() override                 { return true;                }
+    bool getTransformation(Matrix &T) override   { T.resize(4,4); T.eye(); return true; }
+    bool setTransformation(const Matrix &T) override { return true;            }
+};
+
+
+/**********************************************************/
+struct Settings
+{
+    string remote;
+    double duration;
+    int size;
+    double malformed;
+};
+
+
+/**********************************************************/
+class Producer
+{
+protected:
+    const Settings &settings;
+    double rate;
+    mt19937 gen;
+    uniform_real_distribution<double> uniform;
+
+    atomic<bool> &stop;
+    thread th;
+
+    virtual void send()=0;
+
+    void loop()
+    {
+        auto period=chrono::duration<double>((rate>0.0)?1.0/rate:0.0);
+        auto next=chrono::steady_clock::now();
+        while (!stop)
+        {
+            send();
+            sent++;
+            if (rate>0.0)
+            {
+                next+=chrono::duration_cast<chrono::steady_clock::duration>(period);
+                this_thread::sleep_until(next);
+            }
+        }
+    }
+
+public:
+    unsigned long sent{0};
+    unsigned long garbage{0};
+
+    Producer(const Settings &settings, const double rate, const int seed,
+             atomic<bool> &stop) : settings(settings), rate(rate), gen(seed),
+                                   uniform(0.0,1.0), stop(stop) { }
+    virtual ~Producer() { }
+
+    void start()  { th=thread(&Producer::loop,this); }
+    void join()   { if (th.joinable()) th.join();    }
+};
+
+
+/**********************************************************/
+class FeedbackProducer : public Producer
+{
+    BufferedPort<Bottle> port;
+
+    void send() override
+    {
+        Bottle &b=port.prepare();
+        b.clear();
+        if (uniform(gen)<settings.malformed)
+        {
+            garbage++;
+            switch (gen()%5)
+            {
+            case 0:
+                b.addString("garbage");
+                break;
+            case 1:
+                b.addList().addFloat64(1.0);
+                break;
+            case 2:
+                for (int i=0; i<3; i++)
+                    b.addFloat64(numeric_limits<double>::quiet_NaN());
+                break;
+            case 3:
+                for (int i=0; i<64; i++)
+                    b.addFloat64(0.0);
+                break;
+            default:
+                break;
+            }
+        }
+        else
+        {
+            for (int i=0; i<settings.size; i++)
+                b.addFloat64(0.01*(uniform(gen)-0.5));
+        }
+        port.writeStrict();
+    }
+
+public:
+    FeedbackProducer(const Settings &settings, const double rate, const int id,
+                     atomic<bool> &stop) : Producer(settings,rate,id,stop) { }
+
+    bool open(const int id)
+    {
+        string name="/loadgen-hapticdevice/feedback/"+to_string(id)+":o";
+        return port.open(name) &&
+               Network::connect(name,settings.remote+"/feedback:i","tcp");
+    }
+
+    void close()
+    {
+        port.interrupt();
+        port.close();
+    }
+};
+
+
+/**********************************************************/
+class RpcProducer : public Producer
+{
+    RpcClient port;
+
+    void send() override
+    {
+        Bottle cmd,rep;
+        if (uniform(gen)<settings.malformed)
+        {
+            garbage++;
+            switch (gen()%3)
+            {
+            case 0:
+                cmd.addString("garbage");
+                break;
+            case 1:
+                cmd.addVocab32(yarp::os::createVocab32('x','x','x','x'));
+                break;
+            default:
+                cmd.addVocab32(hapticdevice::set_transformation);
+                cmd.addList().addInt32(4);
+                break;
+            }
+        }
+        else
+        {
+            const int vocabs[]={hapticdevice::get_transformation,
+                                hapticdevice::is_cartesian,
+                                hapticdevice::get_max,
+                                hapticdevice::get_time,
+                                hapticdevice::set_transformation};
+            int tag=vocabs[gen()%5];
+            cmd.addVocab32(tag);
+            if (tag==hapticdevice::set_transformation)
+            {
+                Matrix T(4,4);
+                T.eye();
+                cmd.addList().read(T);
+            }
+        }
+
+        port.write(cmd,rep);
+        if (rep.get(0).asVocab32()==hapticdevice::ack)
+            acked++;
+    }
+
+public:
+    unsigned long acked{0};
+
+    RpcProducer(const Settings &settings, const double rate, const int id,
+                atomic<bool> &stop) : Producer(settings,rate,1000+id,stop) { }
+
+    bool open(const int id)
+    {
+        string name="/loadgen-hapticdevice/rpc/"+to_string(id);
+        return port.open(name) &&
+               Network::connect(name,settings.remote+"/rpc","tcp");
+    }
+
+    void close()
+    {
+        port.interrupt();
+        port.close();
+    }
+};
+
+
+/**********************************************************/
+bool getStats(const string &remote, Bottle &stats)
+{
+    RpcClient port;
+    if (!port.open("/loadgen-hapticdevice/stats") ||
+        !Network::connect(port.getName(),remote+"/rpc","tcp"))
+        return false;
+
+    Bottle cmd;
+    cmd.addVocab32(hapticdevice::get_stats);
+    bool ok=port.write(cmd,stats) &&
+            (stats.get(0).asVocab32()==hapticdevice::ack);
+    port.close();
+    return ok;
+}
+
+
+/**********************************************************/
+void printStats(const Bottle &stats)
+{
+    for (size_t i=1; i<stats.size(); i++)
+    {
+        Bottle *item=stats.get(i).asList();
+        if (item==NULL)
+            continue;
+
+        string channel=item->get(0).asString();
+        if (channel=="cycle")
+        {
+            yInfo("cycles=%lld overruns=%lld worst=%.1f us",
+                  (long long)item->get(1).asInt64(),(long long)item->get(2).asInt64(),
+                  1e6*item->get(3).asFloat64());
+            continue;
+        }
+
+        yInfo("%s: %lld messages from sources beyond the table",channel.c_str(),
+              (long long)item->get(1).asInt64());
+        if (Bottle *sources=item->get(2).asList())
+        {
+            for (size_t j=0; j<sources->size(); j++)
+            {
+                Bottle *s=sources->get(j).asList();
+                yInfo("  %s: accepted=%lld throttled=%lld malformed=%lld",
+                      s->get(0).asString().c_str(),(long long)s->get(1).asInt64(),
+                      (long long)s->get(2).asInt64(),(long long)s->get(3).asInt64());
+            }
+        }
+    }
+}
+
+
+/**********************************************************/
+int main(int argc,char *argv[])
+{
+    ResourceFinder rf;
+    rf.configure(argc,argv);
+
+    // with no remote, abuse a wrapper running in this very process
+    bool selfContained=!rf.check("remote");
+    if (selfContained)
+        Network::setLocalMode(true);
+    Network yarp;
+
+    Settings settings;
+    settings.remote=rf.check("remote",Value("/loadgen-hapticdevice-wrapper")).asString();
+    settings.duration=rf.check("duration",Value(5.0)).asFloat64();
+    settings.size=rf.check("feedback-size",Value(3)).asInt32();
+    settings.malformed=rf.check("malformed",Value(0.1)).asFloat64();
+    int nFeedback=rf.check("producers",Value(4)).asInt32();
+    double feedbackRate=rf.check("feedback-rate",Value(5000.0)).asFloat64();
+    int nRpc=rf.check("rpc-clients",Value(1)).asInt32();
+    double rpcRate=rf.check("rpc-rate",Value(1000.0)).asFloat64();
+    double maxCycle=rf.check("max-cycle",Value(0.0)).asFloat64();
+
+    PolyDriver drvDevice;
+    HapticDeviceWrapper wrapper;
+    if (selfContained)
+    {
+        Drivers::factory().add(new DriverCreatorOf<SyntheticDevice>("loadgen_device","","SyntheticDevice"));
+
+        Property optDevice("(device loadgen_device)");
+        Property optWrapper;
+        optWrapper.fromString(rf.toString());
+        optWrapper.put("name",settings.remote.substr(1));
+        if (!drvDevice.open(optDevice) || !wrapper.open(optWrapper))
+        {
+            yError("unable to set up the wrapper!");
+            return 1;
+        }
+        wrapper.setPeriod(1.0/rf.check("wrapper-rate",Value(1000.0)).asFloat64());
+        wrapper.attach(&drvDevice);
+    }
+
+    atomic<bool> stop{false};
+    vector<unique_ptr<FeedbackProducer>> feedback;
+    vector<unique_ptr<RpcProducer>> rpc;
+    bool ok=true;
+    for (int i=0; (i<nFeedback) && ok; i++)
+    {
+        feedback.push_back(unique_ptr<FeedbackProducer>(new FeedbackProducer(settings,feedbackRate,i,stop)));
+        ok=feedback.back()->open(i);
+    }
+    for (int i=0; (i<nRpc) && ok; i++)
+    {
+        rpc.push_back(unique_ptr<RpcProducer>(new RpcProducer(settings,rpcRate,i,stop)));
+        ok=rpc.back()->open(i);
+    }
+
+    if (ok)
+    {
+        yInfo("flooding %s for %g s: %d feedback producers at %g Hz, %d rpc clients at %g Hz, "
+              "%g%% malformed",settings.remote.c_str(),settings.duration,nFeedback,feedbackRate,
+              nRpc,rpcRate,100.0*settings.malformed);
+
+        for (auto &p:feedback)
+            p->start();
+        for (auto &p:rpc)
+            p->start();
+
+        Time::delay(settings.duration);
+        stop=true;
+
+        for (auto &p:feedback)
+            p->join();
+        for (auto &p:rpc)
+            p->join();
+
+        for (size_t i=0; i<feedback.size(); i++)
+            yInfo("feedback producer %zu: sent=%lu (%.0f Hz) malformed=%lu",i,feedback[i]->sent,
+                  feedback[i]->sent/settings.duration,feedback[i]->garbage);
+        for (size_t i=0; i<rpc.size(); i++)
+            yInfo("rpc client %zu: sent=%lu (%.0f Hz) malformed=%lu acked=%lu",i,rpc[i]->sent,
+                  rpc[i]->sent/settings.duration,rpc[i]->garbage,rpc[i]->acked);
+    }
+    else
+        yError("unable to reach %s!",settings.remote.c_str());
+
+    for (auto &p:feedback)
+        p->close();
+    for (auto &p:rpc)
+        p->close();
+
+    Bottle stats;
+    double worst=0.0;
+    if (ok && getStats(settings.remote,stats))
+    {
+        printStats(stats);
+        if (Bottle *cycle=stats.get(stats.size()-1).asList())
+            worst=cycle->get(3).asFloat64();
+    }
+    else if (ok)
+    {
+        yError("unable to retrieve the statistics of the wrapper!");
+        ok=false;
+    }
+
+    if (selfContained)
+    {
+        wrapper.stop();
+        wrapper.close();
+        drvDevice.close();
+    }
+
+    if (ok && (maxCycle>0.0) && (worst>maxCycle))
+    {
+        yError("worst cycle of %.1f us exceeds the bound of %.1f us",1e6*worst,1e6*maxCycle);
+        return 1;
+    }
+
+    return (ok?0:1);
+}
@@ -0,0 +1,253 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <cstdlib>
+#include <new>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/sig/all.h>
+
+#include "hapticdeviceWrapper.h"
+#include "hapticdeviceClient.h"
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+
+// Allocations are counted only on the thread that armed the counter,
+// so that the background activity of the ports does not interfere.
+static thread_local bool armed=false;
+static thread_local size_t allocations=0;
+
+#if defined(__GLIBC__)
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t num, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    if (armed)
+        allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t num, size_t size)
+{
+    if (armed)
+        allocations++;
+    return __libc_calloc(num,size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (armed)
+        allocations++;
+    return __libc_realloc(ptr,size);
+}
+#endif
+
+/**********************************************************/
+static void *allocate(size_t size)
+{
+#if !defined(__GLIBC__)
+    if (armed)
+        allocations++;
+#endif
+    if (void *ptr=std::malloc(size>0?size:1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size)                          { return allocate(size);  }
+void *operator new[](size_t size)                        { return allocate(size);  }
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+void operator delete(void *ptr) noexcept                 { std::free(ptr); }
+void operator delete[](void *ptr) noexcept               { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept         { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept       { std::free(ptr); }
+
+
+/**********************************************************/
+class StandInDevice : public DeviceDriver, public IHapticDevice
+{
+    double t{0.0};
+
+public:
+    void step()                                  { t+=0.001;                   }
+    bool getPosition(Vector &pos) override       { pos.resize(3); pos[0]=t; pos[1]=-t; pos[2]=2.0*t; return true; }
+    bool getOrientation(Vector &rpy) override    { rpy.resize(3); rpy[0]=rpy[1]=rpy[2]=t; return true; }
+    bool getButtons(Vector &buttons) override    { buttons.resize(2); buttons[0]=buttons[1]=0.0; return true; }
+    bool isCartesianForceModeEnabled(bool &ret) override { ret=true; return true; }
+    bool setCartesianForceMode() override        { return true;                }
+    bool setJointTorqueMode() override           { return true;                }
+    bool getMaxFeedback(Vector &max) override    { max.resize(3,1.0); return true; }
+    bool setFeedback(const Vector &fdbck) override { return true;              }
+    bool stopFeedback() override                 { return true;                }
+    bool getTransformation(Matrix &T) override   { return true;                }
+    bool setTransformation(const Matrix &T) override { return true;            }
+};
+
+
+/**********************************************************/
+class FeedbackStream : public ConnectionReader
+{
+    // a binary list of three doubles, as written by the clients
+    std::int32_t header[2]{BOTTLE_TAG_LIST|BOTTLE_TAG_FLOAT64,3};
+    double values[3]{0.1,-0.2,0.3};
+    size_t nHeader{0},nValues{0};
+    Property modifiers;
+
+public:
+    void rewind()                                { nHeader=nValues=0;          }
+    std::int32_t expectInt32() override          { return (nHeader<2)?header[nHeader++]:0; }
+    double expectFloat64() override              { return (nValues<3)?values[nValues++]:0.0; }
+    bool expectBlock(char *data, size_t len) override { return false;          }
+    std::string expectText(const char t) override { return std::string();      }
+    std::int8_t expectInt8() override            { return 0;                   }
+    std::int16_t expectInt16() override          { return 0;                   }
+    std::int64_t expectInt64() override          { return 0;                   }
+    float expectFloat32() override               { return 0.0f;                }
+    bool pushInt(int x) override                 { return false;               }
+    bool isTextMode() const override             { return false;               }
+    bool isBareMode() const override             { return false;               }
+    bool convertTextMode() override              { return true;                }
+    size_t getSize() const override              { return sizeof(header)+sizeof(values); }
+    ConnectionWriter *getWriter() override       { return nullptr;             }
+    Portable *getReference() const override      { return nullptr;             }
+    Contact getRemoteContact() const override    { return Contact("/test-allocations/feedback:o"); }
+    Contact getLocalContact() const override     { return Contact("/test-allocations/feedback:i"); }
+    bool isValid() const override                { return true;                }
+    bool isActive() const override               { return true;                }
+    bool isError() const override                { return false;               }
+    void requestDrop() override                  {                             }
+    const Searchable &getConnectionModifiers() const override { return modifiers; }
+};
+
+
+/**********************************************************/
+class ProbeWrapper : public HapticDeviceWrapper
+{
+public:
+    bool init(IHapticDevice *device)
+    {
+        this->device=device;
+        return threadInit();
+    }
+
+    void sample()  { sampleState(); }
+    void cycle()   { run();         }
+
+    void feedback(FeedbackStream &stream)
+    {
+        stream.rewind();
+        feedbackGate.read(stream);
+    }
+};
+
+
+/**********************************************************/
+class ProbeClient : public HapticDeviceClient
+{
+public:
+    ProbeClient()
+    {
+        statePort.setClient(this);
+        history.resize(64);
+    }
+
+    void deliver(Vector &sample)
+    {
+        static_cast<TypedReaderCallback<Vector>&>(statePort).onRead(sample);
+    }
+};
+
+
+/**********************************************************/
+template <typename F>
+size_t count(F &&f, const int warmup, const int cycles)
+{
+    for (int i=0; i<warmup; i++)
+        f();
+
+    allocations=0;
+    armed=true;
+    for (int i=0; i<cycles; i++)
+        f();
+    armed=false;
+
+    return allocations;
+}
+
+
+/**********************************************************/
+int main(int argc,char *argv[])
+{
+    Network::setLocalMode(true);
+    Network yarp;
+
+    ResourceFinder rf;
+    rf.configure(argc,argv);
+    int warmup=rf.check("warmup",Value(100)).asInt32();
+    int cycles=rf.check("cycles",Value(1000)).asInt32();
+
+    Property options;
+    options.put("name","test-allocations");
+
+    StandInDevice device;
+    ProbeWrapper wrapper;
+    if (!wrapper.open(options) || !wrapper.init(&device))
+    {
+        yError("unable to set up the wrapper!");
+        return 1;
+    }
+
+    FeedbackStream stream;
+    ProbeClient client;
+    Vector sample(8,0.0),pos,rpy,buttons;
+    hapticdevice::HapticState state;
+
+    size_t wrapperAllocs=count([&]() { device.step(); wrapper.sample(); },warmup,cycles);
+    size_t feedbackAllocs=count([&]() { wrapper.feedback(stream); },warmup,cycles);
+    size_t cycleAllocs=count([&]() { device.step(); wrapper.cycle(); },warmup,cycles);
+    size_t clientAllocs=count([&]() {
+        sample[0]+=0.001;
+        client.deliver(sample);
+        client.getPosition(pos);
+        client.getOrientation(rpy);
+        client.getButtons(buttons);
+        client.getState(state);
+        client.getStateAt(state.stamp,state);
+        client.getLastInputStamp();
+    },warmup,cycles);
+
+    yInfo("wrapper state sampling: %zu allocations over %d cycles",wrapperAllocs,cycles);
+    yInfo("wrapper feedback admission: %zu allocations over %d cycles",feedbackAllocs,cycles);
+    yInfo("client decoding and getters: %zu allocations over %d cycles",clientAllocs,cycles);
+    yInfo("wrapper full cycle (transport included): %zu allocations over %d cycles",cycleAllocs,cycles);
+
+    wrapper.close();
+
+    if ((wrapperAllocs>0) || (feedbackAllocs>0) || (clientAllocs>0))
+    {
+        yError("steady state is not allocation free!");
+        return 1;
+    }
+
+    yInfo("steady state is allocation free");
+    return 0;
+}
@@ -0,0 +1,253 @@
+// -*- mode:C++; tab-width:4; c-basic-offset:4; indent-tabs-mode:nil -*-
+
+/*
+ * Copyright (C) 2015 iCub Facility - Istituto Italiano di Tecnologia
+ * Author: Ugo Pattacini
+ * CopyPolicy: Released under the terms of the LGPLv2.1 or later.
+ *
+ */
+
+#include <cmath>
+#include <string>
+
+#include <yarp/os/all.h>
+#include <yarp/dev/all.h>
+#include <yarp/sig/all.h>
+
+#include "hapticdeviceWrapper.h"
+#include "common.h"
+
+using namespace std;
+using namespace yarp::os;
+using namespace yarp::dev;
+using namespace yarp::sig;
+
+
+/**********************************************************/
+class StandInDevice : public DeviceDriver, public IHapticDevice
+{
+public:
+    double x{0.1};
+    double yaw{0.0};
+    double delay{0.0};
+
+    bool getPosition(Vector &pos) override
+    {
+        if (delay>0.0)
+            Time::delay(delay);
+        pos.resize(3,0.0); pos[0]=x;
+        return true;
+    }
+    bool getOrientation(Vector &rpy) override    { rpy.resize(3,0.0); rpy[2]=yaw; return true; }
+    bool getButtons(Vector &buttons) override    { buttons.resize(2,0.0); return true; }
+    bool isCartesianForceModeEnabled(bool &ret) override { ret=true; return true; }
+    bool setCartesianForceMode() override        { return true; }
+    bool setJointTorqueMode() override           { return true; }
+    bool getMaxFeedback(Vector &max) override    { max.resize(3,1.0); return true; }
+    bool setFeedback(const Vector &fdbck) override { return true; }
+    bool stopFeedback() override                 { return true; }
+    bool getTransformation(Matrix &T) override   { return true; }
+    bool setTransformation(const Matrix &T) override { return true; }
+};
+
+
+/**********************************************************/
+class ProbeWrapper : public HapticDeviceWrapper
+{
+public:
+    bool init(IHapticDevice *device)
+    {
+        this->device=device;
+        return threadInit();
+    }
+
+    void release() { threadRelease(); }
+    void cycle()   { run();           }
+
+    void request(const Bottle &cmd, Bottle &rep)
+    {
+        rep.clear();
+        serve("/test-config/source",cmd,rep);
+    }
+
+    unsigned long getCycles() const   { return cycles.load();   }
+    unsigned long getOverruns() const { return overruns.load(); }
+
+    const StateTier *tier(const string &name) const
+    {
+        for (auto &t:tiers)
+            if (t.name==name)
+                return &t;
+        return nullptr;
+    }
+};
+
+
+/**********************************************************/
+static int failures=0;
+
+static void expect(const bool condition, const string &what)
+{
+    if (!condition)
+    {
+        yError("FAILED: %s",what.c_str());
+        failures++;
+    }
+    else
+        yInfo("passed: %s",what.c_str());
+}
+
+
+/**********************************************************/
+static bool opens(const string &config)
+{
+    Property options(config.c_str());
+    options.put("name","test-config");
+    ProbeWrapper wrapper;
+    return wrapper.open(options);
+}
+
+
+/**********************************************************/
+int main(int argc,char *argv[])
+{
+    Network::setLocalMode(true);
+    Network yarp;
+
+    // the period is given in ms and must be positive
+    expect(opens(""),"default period accepted");
+    expect(opens("(period 1.5)"),"fractional period accepted");
+    expect(!opens("(period 0)"),"zero period rejected");
+    expect(!opens("(period -10)"),"negative period rejected");
+    expect(!opens("(period fast)"),"non-numeric period rejected");
+
+    {
+        Property options("(period 20) (state-tiers ((slow 5.0 1.0)))");
+        options.put("name","test-config");
+        ProbeWrapper wrapper;
+        expect(wrapper.open(options) && (fabs(wrapper.getPeriod()-0.02)<1e-9),
+               "period of 20 ms configured as 0.02 s");
+        wrapper.close();
+    }
+
+    // the tiers are derived from the period set through the configuration
+    Property options("(period 1) (state-tiers ((slow 25.0 10.0) (log 50.0) (full 1000.0) (aliased 500.0 800.0)))");
+    options.put("name","test-config");
+
+    StandInDevice device;
+    ProbeWrapper wrapper;
+    if (!wrapper.open(options) || !wrapper.init(&device))
+    {
+        yError("unable to set up the wrapper!");
+        return 1;
+    }
+
+    expect(fabs(wrapper.getPeriod()-0.001)<1e-9,"period of 1 ms configured as 0.001 s");
+
+    const StateTier *slow=wrapper.tier("slow");
+    const StateTier *log=wrapper.tier("log");
+    const StateTier *full=wrapper.tier("full");
+    const StateTier *aliased=wrapper.tier("aliased");
+    expect((slow!=nullptr) && (slow->group!=nullptr) &&
+           (slow->group->decimation==40) && (slow->group->cutoff==10.0),
+           "tier slow decimated by 40 and filtered at 10 Hz");
+    expect((log!=nullptr) && (log->group!=nullptr) &&
+           (log->group->decimation==20) && (log->group->cutoff==0.0),
+           "tier log decimated by 20 and not filtered");
+    expect((full!=nullptr) && (full->group!=nullptr) &&
+           (full->group->decimation==1),"tier full not decimated");
+    expect((aliased!=nullptr) && (aliased->group!=nullptr) &&
+           (aliased->group->decimation==2) && (aliased->group->cutoff==0.0),
+           "tier aliased with its cutoff beyond Nyquist not filtered");
+    expect((slow!=nullptr) && (slow->port!=nullptr) &&
+           (slow->port->getName()=="/test-config/state/slow:o"),
+           "tier slow served on /test-config/state/slow:o");
+
+    // the clients learn the actual rates of the tiers from gsta
+    {
+        Bottle cmd,rep;
+        cmd.addVocab32(hapticdevice::get_stats);
+        wrapper.request(cmd,rep);
+        double rate=0.0;
+        for (size_t i=1; i<rep.size(); i++)
+        {
+            Bottle *list=rep.get(i).asList();
+            if ((list==nullptr) || (list->get(0).asString()!="tiers"))
+                continue;
+
+            for (size_t j=1; j<list->size(); j++)
+            {
+                Bottle *t=list->get(j).asList();
+                if ((t!=nullptr) && (t->get(0).asString()=="slow"))
+                    rate=t->get(1).asFloat64();
+            }
+        }
+        expect(fabs(rate-25.0)<1e-6,"rate of tier slow served by gsta");
+    }
+
+    // the filters start from the first sample instead of the origin
+    for (int i=0; i<40; i++)
+        wrapper.cycle();
+    expect((slow!=nullptr) && (slow->group!=nullptr) &&
+           (fabs(slow->group->sample[0]-device.x)<1e-9),
+           "filtered tier starting from the first sample");
+
+    // a cycle of the stand-in device lasts way less than the period
+    for (int i=0; i<60; i++)
+        wrapper.cycle();
+    expect((wrapper.getCycles()==100) && (wrapper.getOverruns()==0),
+           "no overruns for cycles shorter than the period");
+
+    // a device slower than the period makes the cycle overrun
+    device.delay=2.0*wrapper.getPeriod();
+    wrapper.cycle();
+    device.delay=0.0;
+    expect((wrapper.getCycles()==101) && (wrapper.getOverruns()==1),
+           "overrun counted for a cycle longer than the period");
+
+    // without a renderer, well-formed contact requests are refused
+    // with an explanation, while malformed ones are refused outright
+    Bottle cmd,rep;
+    cmd.addVocab32(hapticdevice::set_contact);
+    cmd.addInt32(500);
+    cmd.addInt32(5);
+    wrapper.request(cmd,rep);
+    expect((rep.size()==2) && (rep.get(0).asVocab32()==hapticdevice::nack),
+           "integer contact parameters accepted and refused by the missing renderer");
+
+    cmd.clear();
+    cmd.addVocab32(hapticdevice::set_contact);
+    cmd.addString("stiff");
+    cmd.addFloat64(5.0);
+    wrapper.request(cmd,rep);
+    expect((rep.size()==1) && (rep.get(0).asVocab32()==hapticdevice::nack),
+           "non-numeric contact parameters rejected");
+
+    cmd.clear();
+    cmd.addVocab32(hapticdevice::get_passivity);
+    wrapper.request(cmd,rep);
+    expect((rep.size()==2) && (rep.get(0).asVocab32()==hapticdevice::nack),
+           "passivity telemetry refused without a passivity controller");
+
+    // a yaw dithering across +/-pi must not be filtered towards zero
+    for (int i=0; i<400; i++)
+    {
+        device.yaw=(i%2==0)?M_PI-0.01:-M_PI+0.01;
+        wrapper.cycle();
+    }
+    expect((slow!=nullptr) && (slow->group!=nullptr) &&
+           (fabs(slow->group->sample[5])>M_PI-0.05),
+           "filtered yaw kept across +/-pi");
+
+    wrapper.release();
+    wrapper.close();
+
+    if (failures>0)
+    {
+        yError("%d checks failed!",failures);
+        return 1;
+    }
+
+    yInfo("all checks passed");
+    return 0;
+}
@@ -7,9 +7,16 @@
  *
  */
 
+#include <cmath>
+#include <string>
 #include <mutex>
+#include <algorithm>
+#include <future>
 
 #include <yarp/os/Log.h>
+#include <yarp/os/Network.h>
+#include <yarp/os/QosStyle.h>
+#include <yarp/os/Time.h>
 #include <yarp/sig/Matrix.h>
 #include <yarp/math/Math.h>
 
@@ -18,6 +25,9 @@
 
 #define HAPTICDEVICE_WRAPPER_DEFAULT_NAME       "hapticdevice"
 #define HAPTICDEVICE_WRAPPER_DEFAULT_PERIOD     0.02 // [s]
+#define HAPTICDEVICE_WRAPPER_HOUSEKEEPING       0.1  // [s]
+#define HAPTICDEVICE_WRAPPER_SOURCE_IDLE        1.0  // [s]
+#define HAPTICDEVICE_WRAPPER_QOS_GRACE          0.1  // [s]
 
 using namespace std;
 using namespace yarp::os;
@@ -25,11 +35,801 @@ using namespace yarp::dev;
 using namespace yarp::sig;
 using namespace yarp::math;
 
+/*********************************************************************/
+static vector<PendingConnection> takeSettled(vector<PendingConnection> &pending)
+{
+    // connections are left alone for a while, so that the reader
+    // can set their QoS before they are moved
+    vector<PendingConnection> settled;
+    double now=Time::now();
+    for (auto it=pending.begin(); it!=pending.end();)
+    {
+        if (now-it->stamp>=HAPTICDEVICE_WRAPPER_QOS_GRACE)
+        {
+            settled.push_back(*it);
+            it=pending.erase(it);
+        }
+        else
+            it++;
+    }
+    return settled;
+}
+
+
+/*********************************************************************/
+static bool moveConnection(const string &from, const string &to,
+                           const string &target, const string &carrier)
+{
+    // the QoS the reader set on the original connection is read
+    // before it gets torn down and carried over to the new one
+    QosStyle srcStyle,destStyle;
+    bool qos=Network::getConnectionQos(from,target,srcStyle,destStyle);
+    if (!Network::connect(to,target,carrier))
+        return false;
+
+    if (qos && !Network::setConnectionQos(to,target,srcStyle,destStyle))
+        yWarning("*** Haptic Device Wrapper: unable to carry the QoS of %s -> %s over to %s",
+                 from.c_str(),target.c_str(),to.c_str());
+    return true;
+}
+
+
+/*********************************************************************/
+bool FeedbackSample::read(ConnectionReader &connection)
+{
+    size=0;
+    if (!connection.convertTextMode())
+        return false;
+
+    int tag=connection.expectInt32();
+    int len=connection.expectInt32();
+    if (((tag&BOTTLE_TAG_LIST)==0) || (len<0) || (len>16))
+        return false;
+
+    // homogeneous lists carry the type of their items only once
+    int listTag=tag&~BOTTLE_TAG_LIST;
+    for (int i=0; i<len; i++)
+    {
+        int itemTag=(listTag!=0)?listTag:connection.expectInt32();
+
+        double value;
+        if (itemTag==BOTTLE_TAG_FLOAT64)
+            value=connection.expectFloat64();
+        else if (itemTag==BOTTLE_TAG_FLOAT32)
+            value=connection.expectFloat32();
+        else if (itemTag==BOTTLE_TAG_INT32)
+            value=connection.expectInt32();
+        else if (itemTag==BOTTLE_TAG_INT64)
+            value=(double)connection.expectInt64();
+        else
+            return false;
+
+        if (size<3)
+            values[size++]=value;
+    }
+
+    return !connection.isError();
+}
+
+
+/*********************************************************************/
+bool FeedbackSample::write(ConnectionWriter &connection) const
+{
+    connection.appendInt32(BOTTLE_TAG_LIST|BOTTLE_TAG_FLOAT64);
+    connection.appendInt32((int)size);
+    for (size_t i=0; i<size; i++)
+        connection.appendFloat64(values[i]);
+
+    return !connection.isError();
+}
+
+
+/*********************************************************************/
+AdmissionControl::AdmissionControl() : rate(0.0), burst(1.0), verbosity(0),
+                                       overflow(0)
+{
+}
+
+
+/*********************************************************************/
+void AdmissionControl::configure(const string &channel, const double rate,
+                                 const double burst, const size_t maxSources,
+                                 const int verbosity)
+{
+    std::lock_guard<std::mutex> lg(mutex);
+    this->channel=channel;
+    this->rate=std::max(0.0,rate);
+    this->burst=std::max(1.0,burst);
+    this->verbosity=verbosity;
+
+    // the table never grows, hence entries do not move around
+    sources.clear();
+    sources.reserve(std::max((size_t)1,maxSources));
+    overflow=0;
+}
+
+
+/*********************************************************************/
+SourceBudget *AdmissionControl::lookup(const string &source, const double now)
+{
+    for (auto &s:sources)
+        if (s.name==source)
+            return &s;
+
+    SourceBudget *slot=nullptr;
+    if (sources.size()<sources.capacity())
+    {
+        sources.push_back(SourceBudget());
+        slot=&sources.back();
+    }
+    else
+    {
+        // recycle the source that has been idle for the longest
+        for (auto &s:sources)
+            if ((now-s.lastSeen>HAPTICDEVICE_WRAPPER_SOURCE_IDLE) &&
+                ((slot==nullptr) || (s.lastSeen<slot->lastSeen)))
+                slot=&s;
+        if (slot==nullptr)
+            return nullptr;
+        *slot=SourceBudget();
+    }
+
+    slot->name=source;
+    slot->tokens=burst;
+    slot->lastSeen=now;
+    return slot;
+}
+
+
+/*********************************************************************/
+SourceBudget *AdmissionControl::lookup(const ConnectionReader &connection,
+                                       const double now)
+{
+    for (auto &s:sources)
+        if (s.connection==&connection)
+            return &s;
+
+    // the contact comes by copy, hence only once per connection
+    SourceBudget *s=lookup(connection.getRemoteContact().getName(),now);
+    if (s!=nullptr)
+        s->connection=&connection;
+    return s;
+}
+
+
+/*********************************************************************/
+bool AdmissionControl::charge(SourceBudget &s, const double now)
+{
+    if (rate>0.0)
+    {
+        s.tokens=std::min(burst,s.tokens+rate*(now-s.lastSeen));
+        s.lastSeen=now;
+        if (s.tokens<1.0)
+        {
+            s.throttled++;
+            if ((verbosity>0) && (now-s.lastWarning>=1.0))
+            {
+                yWarning("*** Haptic Device Wrapper: throttling %s on %s (%lu dropped so far)",
+                         s.name.c_str(),channel.c_str(),s.throttled);
+                s.lastWarning=now;
+            }
+            return false;
+        }
+        s.tokens-=1.0;
+    }
+    else
+        s.lastSeen=now;
+
+    s.accepted++;
+    return true;
+}
+
+
+/*********************************************************************/
+void AdmissionControl::penalize(SourceBudget &s, const double now)
+{
+    s.lastSeen=now;
+    s.malformed++;
+    if ((verbosity>0) && (now-s.lastWarning>=1.0))
+    {
+        yWarning("*** Haptic Device Wrapper: malformed input from %s on %s (%lu so far)",
+                 s.name.c_str(),channel.c_str(),s.malformed);
+        s.lastWarning=now;
+    }
+}
+
+
+/*********************************************************************/
+void AdmissionControl::overflowed(const string &source)
+{
+    if ((verbosity>0) && ((overflow++%1000)==0))
+        yWarning("*** Haptic Device Wrapper: too many sources on %s, %s rejected",
+                 channel.c_str(),source.c_str());
+    else if (verbosity<=0)
+        overflow++;
+}
+
+
+/*********************************************************************/
+bool AdmissionControl::admit(const string &source)
+{
+    double now=Time::now();
+    std::lock_guard<std::mutex> lg(mutex);
+    if (SourceBudget *s=lookup(source,now))
+        return charge(*s,now);
+
+    overflowed(source);
+    return false;
+}
+
+
+/*********************************************************************/
+bool AdmissionControl::admit(const ConnectionReader &connection)
+{
+    double now=Time::now();
+    std::lock_guard<std::mutex> lg(mutex);
+    if (SourceBudget *s=lookup(connection,now))
+        return charge(*s,now);
+
+    overflowed(connection.getRemoteContact().getName());
+    return false;
+}
+
+
+/*********************************************************************/
+void AdmissionControl::reject(const string &source)
+{
+    double now=Time::now();
+    std::lock_guard<std::mutex> lg(mutex);
+    if (SourceBudget *s=lookup(source,now))
+        penalize(*s,now);
+    else
+        overflow++;
+}
+
+
+/*********************************************************************/
+void AdmissionControl::reject(const ConnectionReader &connection)
+{
+    double now=Time::now();
+    std::lock_guard<std::mutex> lg(mutex);
+    if (SourceBudget *s=lookup(connection,now))
+        penalize(*s,now);
+    else
+        overflow++;
+}
+
+
+/*********************************************************************/
+void AdmissionControl::identify(const ConnectionReader &connection,
+                                string &source)
+{
+    double now=Time::now();
+    std::lock_guard<std::mutex> lg(mutex);
+    if (SourceBudget *s=lookup(connection,now))
+        source.assign(s->name);
+    else
+        source=connection.getRemoteContact().getName();
+}
+
+
+/*********************************************************************/
+void AdmissionControl::report(Bottle &stats)
+{
+    std::lock_guard<std::mutex> lg(mutex);
+    Bottle &b=stats.addList();
+    b.addString(channel);
+    b.addInt64(overflow);
+    Bottle &list=b.addList();
+    for (auto &s:sources)
+    {
+        Bottle &entry=list.addList();
+        entry.addString(s.name);
+        entry.addInt64(s.accepted);
+        entry.addInt64(s.throttled);
+        entry.addInt64(s.malformed);
+    }
+}
+
+
+/*********************************************************************/
+void AdmissionControl::report(const PortInfo &info)
+{
+    // a reader may be reused by a new connection once its own is gone
+    if ((info.tag==PortInfo::PORTINFO_CONNECTION) && info.incoming)
+    {
+        std::lock_guard<std::mutex> lg(mutex);
+        for (auto &s:sources)
+            s.connection=nullptr;
+    }
+}
+
+
+/*********************************************************************/
+FeedbackGate::FeedbackGate() : maxValue(0.0), fresh(false)
+{
+}
+
+
+/*********************************************************************/
+void FeedbackGate::configure(const string &channel, const double rate,
+                             const double burst, const size_t maxSources,
+                             const double maxValue, const int verbosity)
+{
+    admission.configure(channel,rate,burst,maxSources,verbosity);
+    this->maxValue=std::fabs(maxValue);
+}
+
+
+/*********************************************************************/
+bool FeedbackGate::read(ConnectionReader &connection)
+{
+    // validate on the reading thread, away from the device lock
+    FeedbackSample sample;
+    bool valid=sample.read(connection) && (sample.size==3);
+    for (size_t i=0; valid && (i<sample.size); i++)
+        valid=std::isfinite(sample.values[i]) &&
+              ((maxValue<=0.0) || (std::fabs(sample.values[i])<=maxValue));
+
+    if (!valid)
+        admission.reject(connection);
+    else if (admission.admit(connection))
+    {
+        std::lock_guard<std::mutex> lg(mutex);
+        latest=sample;
+        fresh=true;
+    }
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool FeedbackGate::fetch(Vector &fdbck)
+{
+    std::lock_guard<std::mutex> lg(mutex);
+    if (!fresh)
+        return false;
+
+    fdbck[0]=latest.values[0];
+    fdbck[1]=latest.values[1];
+    fdbck[2]=latest.values[2];
+    fresh=false;
+    return true;
+}
+
+
+/*********************************************************************/
+StatePublisher::StatePublisher() :
+                PeriodicThread(HAPTICDEVICE_WRAPPER_HOUSEKEEPING),
+                laggardDrops(0), verbosity(0), nextId(0)
+{
+}
+
+
+/*********************************************************************/
+void StatePublisher::configure(const string &statePortName,
+                               const int laggardDrops, const int verbosity)
+{
+    this->statePortName=statePortName;
+    this->laggardDrops=laggardDrops;
+    this->verbosity=verbosity;
+}
+
+
+/*********************************************************************/
+void StatePublisher::report(const PortInfo &info)
+{
+    // new connections are only queued up here, since ports cannot
+    // be handled from within the reports of the port machinery
+    if ((info.tag==PortInfo::PORTINFO_CONNECTION) &&
+        !info.incoming && info.created)
+    {
+        std::lock_guard lg(pendingMutex);
+        pending.push_back({info.targetName,info.carrierName,Time::now()});
+    }
+}
+
+
+/*********************************************************************/
+void StatePublisher::publish(Vector &output, Stamp &stamp)
+{
+    std::lock_guard lg(mutex);
+    for (auto &subscriber:subscribers)
+    {
+        if (subscriber->evicted)
+            continue;
+
+        // a subscriber still busy with the previous sample skips
+        // the present one and will be served with the next one
+        if (subscriber->port.isWriting())
+        {
+            subscriber->dropped++;
+            subscriber->consecutiveDrops++;
+            if ((laggardDrops>0) && (subscriber->consecutiveDrops>=laggardDrops))
+                subscriber->evicted=true;
+        }
+        else
+        {
+            subscriber->port.prepare()=output;
+            subscriber->port.setEnvelope(stamp);
+            subscriber->port.write();
+            subscriber->sent++;
+            subscriber->consecutiveDrops=0;
+        }
+    }
+}
+
+
+/*********************************************************************/
+void StatePublisher::printStats(const StateSubscriber &subscriber,
+                                const char *event)
+{
+    yInfo("*** Haptic Device Wrapper: subscriber %s %s (sent=%lu; dropped=%lu)",
+          subscriber.target.c_str(),event,subscriber.sent,subscriber.dropped);
+}
+
+
+/*********************************************************************/
+void StatePublisher::run()
+{
+    // get rid of subscribers that went away or lagged behind
+    vector<unique_ptr<StateSubscriber>> removed;
+    {
+        std::lock_guard lg(mutex);
+        for (auto it=subscribers.begin(); it!=subscribers.end();)
+        {
+            if ((*it)->evicted || ((*it)->port.getOutputCount()==0))
+            {
+                removed.push_back(std::move(*it));
+                it=subscribers.erase(it);
+            }
+            else
+                it++;
+        }
+    }
+
+    for (auto &subscriber:removed)
+    {
+        if (subscriber->evicted)
+            Network::disconnect(subscriber->port.getName(),subscriber->target);
+        if (subscriber->evicted || (verbosity>0))
+            printStats(*subscriber,subscriber->evicted?"evicted":"left");
+        subscriber->port.interrupt();
+        subscriber->port.close();
+    }
+
+    vector<PendingConnection> requests;
+    {
+        std::lock_guard lg(pendingMutex);
+        requests=takeSettled(pending);
+    }
+
+    // move each new connection over to a dedicated port
+    for (auto &request:requests)
+    {
+        StateSubscriber *known=nullptr;
+        {
+            std::lock_guard lg(mutex);
+            for (auto &subscriber:subscribers)
+                if (subscriber->target==request.target)
+                    known=subscriber.get();
+        }
+
+        if (known!=nullptr)
+            moveConnection(statePortName,known->port.getName(),request.target,request.carrier);
+        else
+        {
+            auto subscriber=make_unique<StateSubscriber>();
+            subscriber->target=request.target;
+            subscriber->carrier=request.carrier;
+            subscriber->port.open(statePortName.substr(0,statePortName.rfind(':'))+
+                                  "/"+to_string(nextId++)+":o");
+
+            if (moveConnection(statePortName,subscriber->port.getName(),
+                               request.target,request.carrier))
+            {
+                if (verbosity>0)
+                    printStats(*subscriber,"joined");
+
+                std::lock_guard lg(mutex);
+                subscribers.push_back(std::move(subscriber));
+            }
+            else
+            {
+                yWarning("*** Haptic Device Wrapper: unable to serve subscriber %s",
+                         request.target.c_str());
+                subscriber->port.close();
+            }
+        }
+
+        Network::disconnect(statePortName,request.target);
+    }
+}
+
+
+/*********************************************************************/
+void StatePublisher::threadRelease()
+{
+    std::lock_guard lg(mutex);
+    for (auto &subscriber:subscribers)
+    {
+        if (verbosity>0)
+            printStats(*subscriber,"released");
+        subscriber->port.interrupt();
+        subscriber->port.close();
+    }
+    subscribers.clear();
+}
+
+
+/*********************************************************************/
+ReplyRouter::ReplyRouter() : PeriodicThread(HAPTICDEVICE_WRAPPER_HOUSEKEEPING),
+                             shared(nullptr), verbosity(0), nextId(0)
+{
+}
+
+
+/*********************************************************************/
+void ReplyRouter::configure(BufferedPort<Bottle> *shared, const int verbosity)
+{
+    this->shared=shared;
+    this->verbosity=verbosity;
+}
+
+
+/*********************************************************************/
+void ReplyRouter::report(const PortInfo &info)
+{
+    // handled by the thread, as for the state subscribers
+    if ((info.tag==PortInfo::PORTINFO_CONNECTION) &&
+        !info.incoming && info.created)
+    {
+        std::lock_guard lg(pendingMutex);
+        pending.push_back({info.targetName,info.carrierName,Time::now()});
+    }
+}
+
+
+/*********************************************************************/
+void ReplyRouter::reply(const string &target, const Bottle &reply)
+{
+    shared_ptr<ReplySubscriber> subscriber;
+    {
+        std::lock_guard lg(mutex);
+        for (auto &s:subscribers)
+            if (s->target==target)
+                subscriber=s;
+    }
+
+    // a client that is still being moved over is reached through
+    // the shared port, which is not connected to the others anymore
+    if (subscriber)
+    {
+        std::lock_guard lg(subscriber->mutex);
+        subscriber->port.prepare()=reply;
+        subscriber->port.writeStrict();
+    }
+    else
+    {
+        std::lock_guard lg(sharedMutex);
+        shared->prepare()=reply;
+        shared->writeStrict();
+    }
+}
+
+
+/*********************************************************************/
+void ReplyRouter::run()
+{
+    vector<shared_ptr<ReplySubscriber>> removed;
+    {
+        std::lock_guard lg(mutex);
+        for (auto it=subscribers.begin(); it!=subscribers.end();)
+        {
+            if ((*it)->port.getOutputCount()==0)
+            {
+                removed.push_back(*it);
+                it=subscribers.erase(it);
+            }
+            else
+                it++;
+        }
+    }
+
+    for (auto &subscriber:removed)
+    {
+        if (verbosity>0)
+            yInfo("*** Haptic Device Wrapper: replies to %s stopped",
+                  subscriber->target.c_str());
+        subscriber->port.interrupt();
+        std::lock_guard lg(subscriber->mutex);
+        subscriber->port.close();
+    }
+
+    vector<PendingConnection> requests;
+    {
+        std::lock_guard lg(pendingMutex);
+        requests=takeSettled(pending);
+    }
+
+    string sharedName=shared->getName();
+    for (auto &request:requests)
+    {
+        shared_ptr<ReplySubscriber> known;
+        {
+            std::lock_guard lg(mutex);
+            for (auto &subscriber:subscribers)
+                if (subscriber->target==request.target)
+                    known=subscriber;
+        }
+
+        if (known)
+            moveConnection(sharedName,known->port.getName(),request.target,request.carrier);
+        else
+        {
+            auto subscriber=make_shared<ReplySubscriber>();
+            subscriber->target=request.target;
+            subscriber->port.open(sharedName.substr(0,sharedName.rfind(':'))+
+                                  "/"+to_string(nextId++)+":o");
+
+            if (moveConnection(sharedName,subscriber->port.getName(),
+                               request.target,request.carrier))
+            {
+                if (verbosity>0)
+                    yInfo("*** Haptic Device Wrapper: replies to %s routed through %s",
+                          request.target.c_str(),subscriber->port.getName().c_str());
+
+                std::lock_guard lg(mutex);
+                subscribers.push_back(subscriber);
+            }
+            else
+            {
+                yWarning("*** Haptic Device Wrapper: unable to route the replies to %s",
+                         request.target.c_str());
+                subscriber->port.close();
+                continue;
+            }
+        }
+
+        Network::disconnect(sharedName,request.target);
+    }
+}
+
+
+/*********************************************************************/
+void ReplyRouter::threadRelease()
+{
+    std::lock_guard lg(mutex);
+    for (auto &subscriber:subscribers)
+    {
+        subscriber->port.interrupt();
+        std::lock_guard lgs(subscriber->mutex);
+        subscriber->port.close();
+    }
+    subscribers.clear();
+}
+
+
+/*********************************************************************/
+EventPublisher::EventPublisher() : port(nullptr), count(0), stopping(false),
+                                   sent(0), overflow(0)
+{
+}
+
+
+/*********************************************************************/
+EventPublisher::~EventPublisher()
+{
+    stop();
+}
+
+
+/*********************************************************************/
+void EventPublisher::start(BufferedPort<Bottle> *port)
+{
+    stop();
+    this->port=port;
+    {
+        std::lock_guard lg(mutex);
+        count=0;
+        stopping=false;
+    }
+    thread=std::thread(&EventPublisher::loop,this);
+}
+
+
+/*********************************************************************/
+void EventPublisher::stop()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard lg(mutex);
+            stopping=true;
+        }
+        condition.notify_one();
+        thread.join();
+    }
+}
+
+
+/*********************************************************************/
+bool EventPublisher::push(const int sequence, const hapticdevice::ButtonEvent &event)
+{
+    std::lock_guard lg(mutex);
+    if (count>=capacity)
+    {
+        overflow++;
+        return false;
+    }
+
+    queue[count++]={sequence,event};
+    return true;
+}
+
+
+/*********************************************************************/
+void EventPublisher::flush(const Stamp &stamp)
+{
+    {
+        std::lock_guard lg(mutex);
+        this->stamp=stamp;
+    }
+    condition.notify_one();
+}
+
+
+/*********************************************************************/
+void EventPublisher::loop()
+{
+    Entry batch[capacity];
+    while (true)
+    {
+        unsigned int n;
+        Stamp envelope;
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            condition.wait(lck,[this]() { return stopping || (count>0); });
+            if (stopping)
+                return;
+
+            n=count;
+            std::copy(queue,queue+n,batch);
+            envelope=stamp;
+            count=0;
+        }
+
+        // (<sequence> <button> <pressed> <stamp>); events are never
+        // dropped here, hence the previous ones are waited for
+        Bottle &events=port->prepare();
+        events.clear();
+        for (unsigned int i=0; i<n; i++)
+        {
+            Bottle &e=events.addList();
+            e.addInt32(batch[i].sequence);
+            e.addInt32(batch[i].event.button);
+            e.addInt32(batch[i].event.pressed?1:0);
+            e.addFloat64(batch[i].event.stamp);
+        }
+        port->setEnvelope(envelope);
+        port->writeStrict();
+        sent+=n;
+    }
+}
+
+
 /*********************************************************************/
 HapticDeviceWrapper::HapticDeviceWrapper() :
                      PeriodicThread(HAPTICDEVICE_WRAPPER_DEFAULT_PERIOD),
-                     device(NULL), applyFdbck(false), fdbck(3,0.0)
+                     latestWins(false), configEpoch(0), device(NULL), renderer(NULL),
+                     passivity(NULL), buttonEvents(NULL), eventSequence(0),
+                     pos(3,0.0),
+                     rpy(3,0.0), buttons(2,0.0), output(9,0.0),
+                     fdbck(3,0.0), applyFdbck(false), worstCycle(0.0),
+                     cycles(0), overruns(0)
 {
+    lastButtons[0]=lastButtons[1]=false;
 }
 
 
@@ -47,9 +847,77 @@ bool HapticDeviceWrapper::open(Searchable &config)
     portStemName=config.check("name",
                               Value(HAPTICDEVICE_WRAPPER_DEFAULT_NAME)).asString().c_str();
     verbosity=config.check("verbosity",Value(0)).asInt32();
-    int period=config.check("period",
-                            Value(HAPTICDEVICE_WRAPPER_DEFAULT_PERIOD)).asFloat64();
-    setPeriod(period);
+    double period=config.check("period",
+                               Value(1e3*HAPTICDEVICE_WRAPPER_DEFAULT_PERIOD)).asFloat64();
+    if (!(period>0.0))
+    {
+        yError("*** Haptic Device Wrapper: the period must be positive (%g ms given)",period);
+        return false;
+    }
+    setPeriod(1e-3*period);
+
+    string publishMode=config.check("publish-mode",Value("strict")).asString();
+    if ((publishMode!="strict") && (publishMode!="latest"))
+    {
+        yError("*** Haptic Device Wrapper: unknown publish-mode \"%s\"",
+               publishMode.c_str());
+        return false;
+    }
+    latestWins=(publishMode=="latest");
+    publisher.configure("/"+portStemName+"/state:o",
+                        config.check("laggard-drops",Value(0)).asInt32(),
+                        verbosity);
+
+    // ((<name> <rate> [<cutoff>])...) served as /<stem>/state/<name>:o
+    tiers.clear();
+    if (config.check("state-tiers"))
+    {
+        Bottle *list=config.find("state-tiers").asList();
+        for (size_t i=0; (list!=NULL) && (i<list->size()); i++)
+        {
+            Bottle *entry=list->get(i).asList();
+            if ((entry==NULL) || (entry->size()<2) || !entry->get(0).isString() ||
+                (entry->get(1).asFloat64()<=0.0) ||
+                ((entry->size()>2) && (entry->get(2).asFloat64()<0.0)))
+            {
+                yError("*** Haptic Device Wrapper: malformed state tier %s",
+                       list->get(i).toString().c_str());
+                return false;
+            }
+
+            // numbers are taken by the ports of the latest-wins subscribers
+            StateTier tier;
+            tier.name=entry->get(0).asString();
+            if (tier.name.find_first_not_of("0123456789")==string::npos)
+            {
+                yError("*** Haptic Device Wrapper: the name of state tier %s cannot be a number",
+                       tier.name.c_str());
+                return false;
+            }
+
+            tier.rate=entry->get(1).asFloat64();
+            tier.cutoff=(entry->size()>2)?entry->get(2).asFloat64():0.0;
+            tiers.push_back(std::move(tier));
+        }
+
+        if (list==NULL)
+        {
+            yError("*** Haptic Device Wrapper: state-tiers must be a list");
+            return false;
+        }
+    }
+
+    size_t maxSources=std::max(1,config.check("max-sources",Value(16)).asInt32());
+    feedbackGate.configure("/"+portStemName+"/feedback:i",
+                           config.check("feedback-rate-limit",Value(2000.0)).asFloat64(),
+                           config.check("feedback-burst",Value(50.0)).asFloat64(),
+                           maxSources,
+                           config.check("feedback-max-value",Value(0.0)).asFloat64(),
+                           verbosity);
+    rpcAdmission.configure("/"+portStemName+"/rpc",
+                           config.check("rpc-rate-limit",Value(200.0)).asFloat64(),
+                           config.check("rpc-burst",Value(20.0)).asFloat64(),
+                           maxSources,verbosity);
 
     if (verbosity>0)
         yInfo("*** Haptic Device Wrapper: opened");
@@ -90,7 +958,27 @@ bool HapticDeviceWrapper::attach(PolyDriver *dev)
         return false;
     }
 
-    start();
+    // contact rendering is optional
+    if (!dev->view(renderer))
+        renderer=NULL;
+    else if (verbosity>0)
+        yInfo("*** Haptic Device Wrapper: device renders contacts with meshes");
+
+    if (!dev->view(passivity))
+        passivity=NULL;
+
+    // without the edges from the device, they get detected by the cycle
+    if (!dev->view(buttonEvents))
+        buttonEvents=NULL;
+    else if (verbosity>0)
+        yInfo("*** Haptic Device Wrapper: device detects the button edges");
+
+    if (!start())
+    {
+        yError("*** Haptic Device Wrapper: unable to start");
+        return false;
+    }
+
     if (verbosity>0)
         yInfo("*** Haptic Device Wrapper: started");
 
@@ -102,19 +990,294 @@ bool HapticDeviceWrapper::attach(PolyDriver *dev)
 bool HapticDeviceWrapper::detach()
 {
     device=nullptr;
+    renderer=nullptr;
+    passivity=nullptr;
+    buttonEvents=nullptr;
+    return true;
+}
+
+/*********************************************************************/
+bool AsyncRequestReader::read(ConnectionReader &connection)
+{
+    Bottle request;
+    if (!request.read(connection))
+        return false;
+    if (wrapper==NULL)
+        return true;
+
+    // requests come as ((<reply-to> <id>) <cmd>...) and are answered
+    // with ((<reply-to> <id>) <rep>...); the identity of the client
+    // is that of the connection, whose <local>/async:o port can only
+    // have the replies addressed to its twin <local>/async:i
+    // one buffer per reading thread, which keeps its capacity
+    thread_local string source;
+    wrapper->rpcAdmission.identify(connection,source);
+    Bottle *header=request.get(0).asList();
+    size_t suffix=source.rfind("/async:o");
+    if ((header==NULL) || (header->size()<2) ||
+        (suffix==string::npos) || (suffix+8!=source.size()) ||
+        (header->get(0).asString()!=source.substr(0,suffix)+"/async:i"))
+    {
+        wrapper->rpcAdmission.reject(source);
+        return true;
+    }
+
+    Bottle cmd=request.tail();
+    Bottle rep;
+    wrapper->serve(source,cmd,rep);
+
+    Bottle reply;
+    reply.addList()=*header;
+    reply.append(rep);
+    wrapper->replyRouter.reply(header->get(0).asString(),reply);
     return true;
 }
 
+
 /*********************************************************************/
 bool HapticDeviceWrapper::read(ConnectionReader &connection)
 {
     Bottle cmd;
     if (!cmd.read(connection))
         return false;
-    int tag=cmd.get(0).asVocab32();
+
+    thread_local string source;
+    rpcAdmission.identify(connection,source);
 
     Bottle rep;
-    if (device!=NULL)
+    serve(source,cmd,rep);
+
+    ConnectionWriter *writer=connection.getWriter();
+    if (writer!=NULL)
+        rep.write(*writer);
+
+    return true;
+}
+
+
+/*********************************************************************/
+bool HapticDeviceWrapper::validate(const Bottle &cmd) const
+{
+    if ((cmd.size()==0) || !cmd.get(0).isVocab32())
+        return false;
+
+    int tag=cmd.get(0).asVocab32();
+    if (tag==hapticdevice::set_transformation)
+    {
+        // expected payload: (4 4 (<16 numbers>))
+        Bottle *payload=(cmd.size()>=2)?cmd.get(1).asList():NULL;
+        if ((payload==NULL) || (payload->size()<3) ||
+            (payload->get(0).asInt32()!=4) || (payload->get(1).asInt32()!=4))
+            return false;
+
+        Bottle *vals=payload->get(2).asList();
+        if ((vals==NULL) || (vals->size()!=16))
+            return false;
+
+        for (size_t i=0; i<vals->size(); i++)
+            if (!vals->get(i).isFloat64() && !vals->get(i).isInt32())
+                return false;
+        return true;
+    }
+    else if (tag==hapticdevice::set_mesh)
+    {
+        // expected payload: (<x y z>...) (<i j k>...)
+        Bottle *vertices=(cmd.size()>=3)?cmd.get(1).asList():NULL;
+        Bottle *triangles=(cmd.size()>=3)?cmd.get(2).asList():NULL;
+        if ((vertices==NULL) || (triangles==NULL) ||
+            (vertices->size()%3!=0) || (triangles->size()%3!=0) ||
+            (triangles->size()==0))
+            return false;
+
+        for (size_t i=0; i<vertices->size(); i++)
+            if (!vertices->get(i).isFloat64() && !vertices->get(i).isInt32())
+                return false;
+        for (size_t i=0; i<triangles->size(); i++)
+            if (!triangles->get(i).isInt32())
+                return false;
+        return true;
+    }
+    else if (tag==hapticdevice::set_contact)
+    {
+        // expected payload: <stiffness> <damping>
+        if (cmd.size()<3)
+            return false;
+
+        for (size_t i=1; i<3; i++)
+            if (!cmd.get(i).isFloat64() && !cmd.get(i).isInt32())
+                return false;
+        return true;
+    }
+
+    return (tag==hapticdevice::get_transformation) ||
+           (tag==hapticdevice::stop_feedback)      ||
+           (tag==hapticdevice::is_cartesian)       ||
+           (tag==hapticdevice::set_cartesian)      ||
+           (tag==hapticdevice::set_joint)          ||
+           (tag==hapticdevice::get_max)            ||
+           (tag==hapticdevice::get_time)           ||
+           (tag==hapticdevice::get_stats)          ||
+           (tag==hapticdevice::clear_mesh)         ||
+           (tag==hapticdevice::get_contact)        ||
+           (tag==hapticdevice::get_passivity);
+}
+
+
+/*********************************************************************/
+void HapticDeviceWrapper::serve(const string &source, const Bottle &cmd,
+                                Bottle &rep)
+{
+    // requests are screened before contending for the device
+    if (!validate(cmd))
+    {
+        rpcAdmission.reject(source);
+        rep.addVocab32(hapticdevice::nack);
+    }
+    else if (!rpcAdmission.admit(source))
+        rep.addVocab32(hapticdevice::nack);
+    else
+        respond(cmd,rep);
+}
+
+
+/*********************************************************************/
+void HapticDeviceWrapper::respondRenderer(const int tag, const Bottle &cmd,
+                                          Bottle &rep)
+{
+    if (tag==hapticdevice::set_mesh)
+    {
+        Bottle *vertices=cmd.get(1).asList();
+        Bottle *triangles=cmd.get(2).asList();
+
+        vector<double> v(vertices->size());
+        for (size_t i=0; i<v.size(); i++)
+            v[i]=vertices->get(i).asFloat64();
+        vector<int> t(triangles->size());
+        for (size_t i=0; i<t.size(); i++)
+            t[i]=triangles->get(i).asInt32();
+
+        if (renderer->setMesh(v,t))
+        {
+            rep.addVocab32(hapticdevice::ack);
+            if (verbosity>0)
+                yInfo("*** Haptic Device Wrapper: mesh of %zu triangles uploaded",
+                      t.size()/3);
+        }
+        else
+        {
+            rep.addVocab32(hapticdevice::nack);
+            rep.addString("the device refused the mesh");
+        }
+    }
+    else if (tag==hapticdevice::clear_mesh)
+        rep.addVocab32(renderer->clearMesh()?hapticdevice::ack:hapticdevice::nack);
+    else if (tag==hapticdevice::set_contact)
+        rep.addVocab32(renderer->setContactParameters(cmd.get(1).asFloat64(),
+                                                      cmd.get(2).asFloat64())?
+                       hapticdevice::ack:hapticdevice::nack);
+    else if (tag==hapticdevice::get_contact)
+    {
+        bool contact;
+        Vector proxy,force;
+        double worst;
+        int exhausted;
+        if (renderer->getContact(contact,proxy,force) &&
+            renderer->getRenderStats(worst,exhausted))
+        {
+            rep.addVocab32(hapticdevice::ack);
+            rep.addInt32(contact?1:0);
+            rep.addList().read(proxy);
+            rep.addList().read(force);
+            rep.addFloat64(worst);
+            rep.addInt32(exhausted);
+        }
+        else
+            rep.addVocab32(hapticdevice::nack);
+    }
+}
+
+
+/*********************************************************************/
+void HapticDeviceWrapper::respond(const Bottle &cmd, Bottle &rep)
+{
+    int tag=cmd.get(0).asVocab32();
+    if (tag==hapticdevice::get_time)
+    {
+        // served straightaway, without waiting for the device
+        double t=Time::now();
+        rep.addVocab32(hapticdevice::ack);
+        rep.addFloat64(t);
+        rep.addFloat64(Time::now());
+    }
+    else if (tag==hapticdevice::get_stats)
+    {
+        rep.addVocab32(hapticdevice::ack);
+        feedbackGate.report(rep);
+        rpcAdmission.report(rep);
+
+        Bottle &events=rep.addList();
+        unsigned long lost=0;
+        if (buttonEvents!=NULL)
+            buttonEvents->getLostButtonEvents(lost);
+        events.addString("events");
+        events.addInt64(eventPublisher.getSent());
+        events.addInt64(lost);
+        events.addInt64(eventPublisher.getOverflow());
+
+        Bottle &cycle=rep.addList();
+        cycle.addString("cycle");
+        cycle.addInt64(cycles.load());
+        cycle.addInt64(overruns.load());
+        cycle.addFloat64(worstCycle.load());
+
+        // the actual rates, as the clients cannot tell them otherwise
+        Bottle &rates=rep.addList();
+        rates.addString("tiers");
+        for (auto &tier:tiers)
+        {
+            if (tier.group==nullptr)
+                continue;
+
+            Bottle &t=rates.addList();
+            t.addString(tier.name);
+            t.addFloat64(1.0/(tier.group->decimation*getPeriod()));
+        }
+    }
+    else if ((tag==hapticdevice::set_mesh)    || (tag==hapticdevice::clear_mesh) ||
+             (tag==hapticdevice::set_contact) || (tag==hapticdevice::get_contact))
+    {
+        // the renderer is thread-safe, and building a mesh
+        // must not hold the cycle back
+        if (renderer!=NULL)
+            respondRenderer(tag,cmd,rep);
+        else
+        {
+            rep.addVocab32(hapticdevice::nack);
+            rep.addString("the device does not render contacts");
+        }
+    }
+    else if (tag==hapticdevice::get_passivity)
+    {
+        // the telemetry is read lock-free off the servo loop
+        double energy,damping,dissipated;
+        int active;
+        if ((passivity!=NULL) &&
+            passivity->getPassivity(energy,damping,dissipated,active))
+        {
+            rep.addVocab32(hapticdevice::ack);
+            rep.addFloat64(energy);
+            rep.addFloat64(damping);
+            rep.addFloat64(dissipated);
+            rep.addInt32(active);
+        }
+        else
+        {
+            rep.addVocab32(hapticdevice::nack);
+            if (passivity==NULL)
+                rep.addString("the device does not run a passivity controller");
+        }
+    }
+    else if (device!=NULL)
     {
         std::lock_guard lg(mutex);
 
@@ -134,7 +1297,10 @@ bool HapticDeviceWrapper::read(ConnectionReader &connection)
                                 T(r,c)=vals->get(T.rows()*r+c).asFloat64();
 
                         if (device->setTransformation(T))
+                        {
+                            configEpoch++;
                             rep.addVocab32(hapticdevice::ack);
+                        }
                         else
                             rep.addVocab32(hapticdevice::nack);
                     }
@@ -172,13 +1338,23 @@ bool HapticDeviceWrapper::read(ConnectionReader &connection)
         }
         else if (tag==hapticdevice::set_cartesian)
         {
-            rep.addVocab32(device->setCartesianForceMode()?
-                         hapticdevice::ack:hapticdevice::nack);
+            if (device->setCartesianForceMode())
+            {
+                configEpoch++;
+                rep.addVocab32(hapticdevice::ack);
+            }
+            else
+                rep.addVocab32(hapticdevice::nack);
         }
         else if (tag==hapticdevice::set_joint)
         {
-            rep.addVocab32(device->setJointTorqueMode()?
-                         hapticdevice::ack:hapticdevice::nack);
+            if (device->setJointTorqueMode())
+            {
+                configEpoch++;
+                rep.addVocab32(hapticdevice::ack);
+            }
+            else
+                rep.addVocab32(hapticdevice::nack);
         }
         else if (tag==hapticdevice::get_max)
         {
@@ -195,22 +1371,112 @@ bool HapticDeviceWrapper::read(ConnectionReader &connection)
 
     if (rep.size()==0)
         rep.addVocab32(hapticdevice::nack);
+}
 
-    ConnectionWriter *writer=connection.getWriter();
-    if (writer!=NULL)
-        rep.write(*writer);
 
-    return true;
+/*********************************************************************/
+void HapticDeviceWrapper::publishEvents()
+{
+    bool any=false;
+    auto append=[&](const hapticdevice::ButtonEvent &event) {
+        // the number is spent even when the event is given up
+        eventPublisher.push(eventSequence++,event);
+        any=true;
+    };
+
+    hapticdevice::ButtonEvent event;
+    if (buttonEvents!=NULL)
+    {
+        while (buttonEvents->getButtonEvent(event))
+            append(event);
+    }
+    else
+    {
+        for (int i=0; i<2; i++)
+        {
+            bool level=(output[6+i]!=0.0);
+            if (level!=lastButtons[i])
+            {
+                lastButtons[i]=level;
+                append({i,level,stamp.getTime()});
+            }
+        }
+    }
+
+    if (any)
+        eventPublisher.flush(stamp);
 }
 
 
 /*********************************************************************/
 bool HapticDeviceWrapper::threadInit()
 {
-    statePort.open(("/"+portStemName+"/state:o").c_str());
-    feedbackPort.open(("/"+portStemName+"/feedback:i").c_str());
-    rpcPort.open(("/"+portStemName+"/rpc").c_str());
+    double t0=Time::now();
+    string stem="/"+portStemName;
+
+    // the readers are in place before the ports become reachable
+    feedbackPort.setReader(feedbackGate);
+    feedbackPort.setReporter(feedbackGate.getReporter());
     rpcPort.setReader(*this);
+    rpcPort.setReporter(rpcAdmission);
+    asyncRequestReader.setWrapper(this);
+    asyncRequestPort.setReader(asyncRequestReader);
+    asyncRequestPort.setReporter(rpcAdmission);
+    replyRouter.configure(&asyncReplyPort,verbosity);
+    setupTiers();
+
+    vector<pair<string,Contactable*>> ports={
+        {stem+"/state:o",&statePort},
+        {stem+"/feedback:i",&feedbackPort},
+        {stem+"/rpc",&rpcPort},
+        {stem+"/async:i",&asyncRequestPort},
+        {stem+"/async:o",&asyncReplyPort},
+        {stem+"/events:o",&eventPort}
+    };
+    for (auto &tier:tiers)
+        ports.push_back(make_pair(stem+"/state/"+tier.name+":o",tier.port.get()));
+
+    // the registrations with the name server are independent
+    // of each other, hence they are carried out concurrently
+    vector<future<bool>> opened;
+    for (auto &port:ports)
+        opened.push_back(async(launch::async,[&port](){
+            return port.second->open(port.first);
+        }));
+
+    bool ok=true;
+    for (size_t i=0; i<ports.size(); i++)
+    {
+        if (!opened[i].get())
+        {
+            yError("*** Haptic Device Wrapper: unable to open %s",
+                   ports[i].first.c_str());
+            ok=false;
+        }
+    }
+
+    if (!ok)
+    {
+        threadRelease();
+        return false;
+    }
+    double t1=Time::now();
+
+    eventPublisher.start(&eventPort);
+    asyncReplyPort.setReporter(replyRouter);
+    replyRouter.start();
+    if (latestWins)
+    {
+        statePort.setReporter(publisher);
+        publisher.start();
+    }
+
+    if (verbosity>0)
+    {
+        double t2=Time::now();
+        yInfo("*** Haptic Device Wrapper: startup took %.1f ms (ports %.1f ms, publishers %.1f ms)",
+              1e3*(t2-t0),1e3*(t1-t0),1e3*(t2-t1));
+    }
 
     return true;
 }
@@ -219,48 +1485,210 @@ bool HapticDeviceWrapper::threadInit()
 /*********************************************************************/
 void HapticDeviceWrapper::threadRelease()
 {
+    if (replyRouter.isRunning())
+    {
+        asyncReplyPort.resetReporter();
+        replyRouter.stop();
+    }
+
+    if (publisher.isRunning())
+    {
+        statePort.resetReporter();
+        publisher.stop();
+    }
+
     statePort.interrupt();
     feedbackPort.interrupt();
     rpcPort.interrupt();
+    asyncRequestPort.interrupt();
+    asyncReplyPort.interrupt();
+    eventPort.interrupt();
+    eventPublisher.stop();
 
     statePort.close();
     feedbackPort.close();
     rpcPort.close();
+    asyncRequestPort.close();
+    asyncReplyPort.close();
+    eventPort.close();
+
+    for (auto &tier:tiers)
+    {
+        if (tier.port)
+        {
+            tier.port->interrupt();
+            tier.port->close();
+            tier.port.reset();
+        }
+        tier.group=nullptr;
+    }
+    tierGroups.clear();
 }
 
 
 /*********************************************************************/
-void HapticDeviceWrapper::run()
+void HapticDeviceWrapper::setupTiers()
 {
-    if (device!=NULL)
+    // the decimation follows from the period the cycle runs at
+    double rate=1.0/getPeriod();
+    tierGroups.clear();
+    for (auto &tier:tiers)
     {
-        std::lock_guard lg(mutex);
+        int decimation=std::max(1,(int)std::lround(rate/tier.rate));
+        double cutoff=tier.cutoff;
+        if (cutoff>=0.5*rate)
+        {
+            yWarning("*** Haptic Device Wrapper: cutoff of tier %s beyond %g Hz, filter disabled",
+                     tier.name.c_str(),0.5*rate);
+            cutoff=0.0;
+        }
+
+        tier.group=nullptr;
+        for (auto &group:tierGroups)
+            if ((group->decimation==decimation) && (group->cutoff==cutoff))
+                tier.group=group.get();
 
-        Vector pos,rpy,buttons;
-        device->getPosition(pos);
-        device->getOrientation(rpy);
-        device->getButtons(buttons);
+        if (tier.group==nullptr)
+        {
+            auto group=make_unique<StateTierGroup>();
+            group->decimation=decimation;
+            group->cutoff=cutoff;
+            group->sample.resize(output.length(),0.0);
+            if (cutoff>0.0)
+            {
+                group->posFilter.addStage(hapticdevice::BiquadFilterBank::lowPass(cutoff,rate));
+                group->rpyFilter.addStage(hapticdevice::BiquadFilterBank::lowPass(cutoff,rate));
+            }
+            tier.group=group.get();
+            tierGroups.push_back(std::move(group));
+        }
 
-        Vector output=cat(cat(pos,rpy),buttons);
-        statePort.prepare().read(output);
+        // opened along with the other ports
+        tier.port=make_unique<BufferedPort<Vector>>();
+        if (verbosity>0)
+            yInfo("*** Haptic Device Wrapper: tier %s at %g Hz (decimation %d, cutoff %g Hz)",
+                  tier.name.c_str(),rate/decimation,decimation,cutoff);
+    }
+}
 
-        stamp.update();
-        statePort.setEnvelope(stamp);
-        statePort.writeStrict();
 
-        if (Bottle *fdbck=feedbackPort.read(false))
+/*********************************************************************/
+void HapticDeviceWrapper::publishTiers()
+{
+    // each group filters and packs its sample once for all its tiers
+    for (auto &group:tierGroups)
+    {
+        bool filtered=(group->cutoff>0.0);
+        if (filtered && !group->primed)
+        {
+            // the filters start from the first sample, not to make
+            // the subscribers see a ramp from the origin
+            for (int i=0; i<3; i++)
+                group->rpyLast[i]=group->rpyUnwrapped[i]=output[3+i];
+            group->posFilter.prime(output.data());
+            group->rpyFilter.prime(group->rpyUnwrapped);
+            group->primed=true;
+        }
+        else if (filtered)
         {
-            if (fdbck->size()>=3)
+            group->posFilter.push(output.data());
+
+            // filtering the raw angles would turn each jump across
+            // +/-pi into a swing through the whole range
+            for (int i=0; i<3; i++)
             {
-                this->fdbck[0]=fdbck->get(0).asFloat64();
-                this->fdbck[1]=fdbck->get(1).asFloat64();
-                this->fdbck[2]=fdbck->get(2).asFloat64();
+                double angle=output[3+i];
+                group->rpyUnwrapped[i]+=std::remainder(angle-group->rpyLast[i],2.0*M_PI);
+                group->rpyLast[i]=angle;
             }
+            group->rpyFilter.push(group->rpyUnwrapped);
+        }
 
-            applyFdbck=true;
+        group->ready=(++group->counter>=group->decimation);
+        if (group->ready)
+        {
+            group->counter=0;
+            group->sample=output;
+            if (filtered)
+            {
+                group->posFilter.get(group->sample.data());
+                group->rpyFilter.get(group->sample.data()+3);
+                for (int i=3; i<6; i++)
+                    group->sample[i]=std::remainder(group->sample[i],2.0*M_PI);
+            }
+        }
+    }
+
+    // slow consumers are never waited for
+    for (auto &tier:tiers)
+    {
+        if ((tier.group!=nullptr) && tier.group->ready &&
+            (tier.port->getOutputCount()>0))
+        {
+            tier.port->prepare()=tier.group->sample;
+            tier.port->setEnvelope(stamp);
+            tier.port->write();
+        }
+    }
+}
+
+
+/*********************************************************************/
+void HapticDeviceWrapper::sampleState()
+{
+    device->getPosition(pos);
+    device->getOrientation(rpy);
+    device->getButtons(buttons);
+
+    // fill in the output in place, sparing temporaries
+    std::copy(pos.begin(),pos.begin()+std::min(pos.length(),(size_t)3),
+              output.begin());
+    std::copy(rpy.begin(),rpy.begin()+std::min(rpy.length(),(size_t)3),
+              output.begin()+3);
+    std::copy(buttons.begin(),buttons.begin()+std::min(buttons.length(),(size_t)2),
+              output.begin()+6);
+
+    // let clients know when their cached properties become stale
+    output[8]=configEpoch;
+}
+
+
+/*********************************************************************/
+void HapticDeviceWrapper::run()
+{
+    if (device!=NULL)
+    {
+        double t0=Time::now();
+        std::lock_guard lg(mutex);
+
+        sampleState();
+        stamp.update();
+
+        if (latestWins)
+            publisher.publish(output,stamp);
+        else
+        {
+            statePort.prepare()=output;
+            statePort.setEnvelope(stamp);
+            statePort.writeStrict();
         }
 
+        if (!tierGroups.empty())
+            publishTiers();
+        publishEvents();
+
+        // only samples already validated and admitted get here
+        if (feedbackGate.fetch(fdbck))
+            applyFdbck=true;
+
         if (applyFdbck)
             device->setFeedback(fdbck);
+
+        double dt=Time::now()-t0;
+        if (dt>worstCycle.load(std::memory_order_relaxed))
+            worstCycle.store(dt,std::memory_order_relaxed);
+        if (dt>getPeriod())
+            overruns.fetch_add(1,std::memory_order_relaxed);
+        cycles.fetch_add(1,std::memory_order_relaxed);
     }
 }
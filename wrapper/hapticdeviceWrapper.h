@@ -11,11 +11,20 @@
 #define __HAPTICDEVICE_WRAPPER__
 
 #include <string>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <yarp/os/PeriodicThread.h>
 #include <yarp/os/PortReader.h>
+#include <yarp/os/PortReport.h>
+#include <yarp/os/PortInfo.h>
 #include <yarp/os/RpcServer.h>
+#include <yarp/os/Port.h>
 #include <yarp/os/BufferedPort.h>
 #include <yarp/os/Bottle.h>
 #include <yarp/os/Stamp.h>
@@ -24,6 +33,321 @@
 #include <yarp/dev/IHapticDevice.h>
 #include <yarp/sig/Vector.h>
 
+#include "IHapticRenderer.h"
+#include "IHapticPassivity.h"
+#include "IHapticButtonEvents.h"
+#include "biquadFilterBank.h"
+
+/**
+ * Force feedback as received from the network, parsed in place
+ * so that reading it does not require any allocation.
+ */
+class FeedbackSample : public yarp::os::Portable
+{
+public:
+    double values[3];
+    size_t size{0};
+
+    bool read(yarp::os::ConnectionReader &connection) override;
+    bool write(yarp::os::ConnectionWriter &connection) const override;
+};
+
+
+/**
+ * Traffic accounting of a single source of requests.
+ */
+struct SourceBudget
+{
+    std::string name;
+    const void *connection{nullptr};
+    double tokens{0.0};
+    double lastSeen{0.0};
+    double lastWarning{0.0};
+
+    unsigned long accepted{0};
+    unsigned long throttled{0};
+    unsigned long malformed{0};
+};
+
+
+/**
+ * Per-source token buckets shielding the wrapper from floods: each
+ * source can sustain its own rate with some burst, and only a bounded
+ * number of sources is tracked, the idle ones making room for the new.
+ * The name of a source is resolved once per connection, which is then
+ * recognized by its reader, until the connections of the port change.
+ */
+class AdmissionControl : public yarp::os::PortReport
+{
+    std::string channel;
+    double rate,burst;
+    int verbosity;
+
+    std::mutex mutex;
+    std::vector<SourceBudget> sources;
+    unsigned long overflow;
+
+    SourceBudget *lookup(const std::string &source, const double now);
+    SourceBudget *lookup(const yarp::os::ConnectionReader &connection,
+                         const double now);
+    bool charge(SourceBudget &s, const double now);
+    void penalize(SourceBudget &s, const double now);
+    void overflowed(const std::string &source);
+
+public:
+    AdmissionControl();
+
+    void configure(const std::string &channel, const double rate,
+                   const double burst, const size_t maxSources,
+                   const int verbosity);
+    bool admit(const std::string &source);
+    bool admit(const yarp::os::ConnectionReader &connection);
+    void reject(const std::string &source);
+    void reject(const yarp::os::ConnectionReader &connection);
+    void identify(const yarp::os::ConnectionReader &connection,
+                  std::string &source);
+    void report(yarp::os::Bottle &stats);
+    void report(const yarp::os::PortInfo &info) override;
+};
+
+
+/**
+ * Entry point of the force feedback, where the samples are
+ * validated and rate-limited before reaching the cycle, which
+ * only picks up the latest one admitted.
+ */
+class FeedbackGate : public yarp::os::PortReader
+{
+    AdmissionControl admission;
+    double maxValue;
+
+    std::mutex mutex;
+    FeedbackSample latest;
+    bool fresh;
+
+public:
+    FeedbackGate();
+
+    void configure(const std::string &channel, const double rate,
+                   const double burst, const size_t maxSources,
+                   const double maxValue, const int verbosity);
+    bool read(yarp::os::ConnectionReader &connection) override;
+    bool fetch(yarp::sig::Vector &fdbck);
+    void report(yarp::os::Bottle &stats) { admission.report(stats); }
+    yarp::os::PortReport &getReporter()  { return admission;        }
+};
+
+
+/**
+ * Connection waiting to be moved over to a dedicated port.
+ */
+struct PendingConnection
+{
+    std::string target;
+    std::string carrier;
+    double stamp;
+};
+
+
+/**
+ * Non-blocking slot serving a single state subscriber.
+ */
+struct StateSubscriber
+{
+    std::string target;
+    std::string carrier;
+    yarp::os::BufferedPort<yarp::sig::Vector> port;
+
+    unsigned long sent{0};
+    unsigned long dropped{0};
+    int consecutiveDrops{0};
+    bool evicted{false};
+};
+
+
+/**
+ * Fan-out of the state stream where each subscriber owns a
+ * latest-wins slot, so that slow readers never stall the wrapper.
+ */
+class StatePublisher : public yarp::os::PortReport,
+                       public yarp::os::PeriodicThread
+{
+    std::string statePortName;
+    int laggardDrops;
+    int verbosity;
+    unsigned int nextId;
+
+    std::mutex pendingMutex;
+    std::vector<PendingConnection> pending;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<StateSubscriber>> subscribers;
+
+
+    void printStats(const StateSubscriber &subscriber, const char *event);
+    void run() override;
+    void threadRelease() override;
+
+public:
+    StatePublisher();
+
+    void configure(const std::string &statePortName,
+                   const int laggardDrops, const int verbosity);
+    void report(const yarp::os::PortInfo &info) override;
+    void publish(yarp::sig::Vector &output, yarp::os::Stamp &stamp);
+};
+
+
+/**
+ * Decimated, and optionally low-pass filtered, version of the state
+ * stream. Tiers with the same decimation and filter belong to the
+ * same group, which filters and packs the sample once for all.
+ */
+struct StateTierGroup
+{
+    int decimation{1};
+    double cutoff{0.0};
+    int counter{0};
+    bool ready{false};
+
+    hapticdevice::BiquadFilterBank posFilter;
+    hapticdevice::BiquadFilterBank rpyFilter;
+    yarp::sig::Vector sample;
+
+    // the filters are primed with the first sample, and the angles
+    // are filtered unwrapped, i.e. continuous across +/-pi
+    bool primed{false};
+    double rpyLast[3]{0.0,0.0,0.0};
+    double rpyUnwrapped[3]{0.0,0.0,0.0};
+};
+
+
+/**
+ * Additional state output port running at a reduced rate.
+ */
+struct StateTier
+{
+    std::string name;
+    double rate{0.0};
+    double cutoff{0.0};
+
+    StateTierGroup *group{nullptr};
+    std::unique_ptr<yarp::os::BufferedPort<yarp::sig::Vector>> port;
+};
+
+
+/**
+ * Hand-over of the button events from the cycle to a thread of their
+ * own, which waits for the readers in place of the cycle. The queue
+ * is bounded: the events that do not fit are counted and given up,
+ * leaving a gap in the sequence numbers seen by the readers.
+ */
+class EventPublisher
+{
+public:
+    static const unsigned int capacity=256;
+
+    EventPublisher();
+    ~EventPublisher();
+
+    void start(yarp::os::BufferedPort<yarp::os::Bottle> *port);
+    void stop();
+    bool push(const int sequence, const hapticdevice::ButtonEvent &event);
+    void flush(const yarp::os::Stamp &stamp);
+
+    unsigned long getSent() const     { return sent.load();     }
+    unsigned long getOverflow() const { return overflow.load(); }
+
+private:
+    struct Entry
+    {
+        int sequence;
+        hapticdevice::ButtonEvent event;
+    };
+
+    yarp::os::BufferedPort<yarp::os::Bottle> *port;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    Entry queue[capacity];
+    unsigned int count;
+    yarp::os::Stamp stamp;
+    bool stopping;
+
+    std::atomic<unsigned long> sent;
+    std::atomic<unsigned long> overflow;
+
+    void loop();
+};
+
+
+/**
+ * Dedicated stream of the replies to the asynchronous requests of
+ * a single client.
+ */
+struct ReplySubscriber
+{
+    std::string target;
+    std::mutex mutex;
+    yarp::os::BufferedPort<yarp::os::Bottle> port;
+};
+
+
+/**
+ * Routing of the replies to the asynchronous requests, where each
+ * connection made to the stream of replies is moved over to a port
+ * of its own, so that every client receives only its replies.
+ */
+class ReplyRouter : public yarp::os::PortReport,
+                    public yarp::os::PeriodicThread
+{
+    yarp::os::BufferedPort<yarp::os::Bottle> *shared;
+    int verbosity;
+    unsigned int nextId;
+
+    std::mutex pendingMutex;
+    std::vector<PendingConnection> pending;
+
+    std::mutex sharedMutex;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ReplySubscriber>> subscribers;
+
+    void run() override;
+    void threadRelease() override;
+
+public:
+    ReplyRouter();
+
+    void configure(yarp::os::BufferedPort<yarp::os::Bottle> *shared,
+                   const int verbosity);
+    void report(const yarp::os::PortInfo &info) override;
+    void reply(const std::string &target, const yarp::os::Bottle &reply);
+};
+
+
+class HapticDeviceWrapper;
+
+/**
+ * One-way channel of requests that can be pipelined by the clients
+ * without waiting for the replies to the previous ones.
+ */
+class AsyncRequestReader : public yarp::os::PortReader
+{
+    HapticDeviceWrapper *wrapper;
+
+public:
+    AsyncRequestReader() : wrapper(NULL) { }
+
+    void setWrapper(HapticDeviceWrapper *wrapper_)
+    {
+        this->wrapper=wrapper_;
+    }
+
+    bool read(yarp::os::ConnectionReader &connection) override;
+};
+
+
 /**
  * Haptic Device wrapper
  */
@@ -36,19 +360,63 @@ protected:
     std::string portStemName;
     int verbosity;
 
-    yarp::os::BufferedPort<yarp::os::Bottle> statePort;
-    yarp::os::BufferedPort<yarp::os::Bottle> feedbackPort;
-    yarp::os::RpcServer                      rpcPort;
+    yarp::os::BufferedPort<yarp::sig::Vector> statePort;
+    yarp::os::Port                            feedbackPort;
+    yarp::os::RpcServer                       rpcPort;
+
+    FeedbackGate feedbackGate;
+    AdmissionControl rpcAdmission;
+
+    friend AsyncRequestReader;
+    yarp::os::Port                            asyncRequestPort;
+    yarp::os::BufferedPort<yarp::os::Bottle>  asyncReplyPort;
+    AsyncRequestReader                        asyncRequestReader;
+    ReplyRouter                               replyRouter;
+    yarp::os::BufferedPort<yarp::os::Bottle>  eventPort;
+
+    bool latestWins;
+    StatePublisher publisher;
+
+    std::vector<StateTier> tiers;
+    std::vector<std::unique_ptr<StateTierGroup>> tierGroups;
 
     std::mutex mutex;
     yarp::os::Stamp stamp;
+    int configEpoch;
 
     yarp::dev::PolyDriver driver;
     yarp::dev::IHapticDevice *device;
+    hapticdevice::IHapticRenderer *renderer;
+    hapticdevice::IHapticPassivity *passivity;
+    hapticdevice::IHapticButtonEvents *buttonEvents;
+
+    // button edges, numbered so that readers can spot gaps
+    bool lastButtons[2];
+    int eventSequence;
+    EventPublisher eventPublisher;
+
+    // buffers preallocated for the cycle
+    yarp::sig::Vector pos,rpy,buttons;
+    yarp::sig::Vector output;
 
     yarp::sig::Vector fdbck;
     bool applyFdbck;
 
+    // cycle timing, written by the cycle only
+    std::atomic<double> worstCycle;
+    std::atomic<unsigned long> cycles;
+    std::atomic<unsigned long> overruns;
+
+    void sampleState();
+    void setupTiers();
+    void publishTiers();
+    void publishEvents();
+    bool validate(const yarp::os::Bottle &cmd) const;
+    void serve(const std::string &source, const yarp::os::Bottle &cmd,
+               yarp::os::Bottle &rep);
+    void respondRenderer(const int tag, const yarp::os::Bottle &cmd,
+                         yarp::os::Bottle &rep);
+    void respond(const yarp::os::Bottle &cmd, yarp::os::Bottle &rep);
     bool read(yarp::os::ConnectionReader &connection) override;
     bool threadInit() override;
     void threadRelease() override;